@@ -0,0 +1,98 @@
+// Benchmark behind report.md section 6: std::set vs ESet vs BPlusESet
+// on 1M random ints (same seed and distribution as the appendix program).
+// Unlike the appendix, every run starts from an empty set and iteration is
+// timed while the set is full, before the keys are erased.
+//
+//   g++ -std=c++20 -O2 -Iinclude bench/bplus.cpp -o bplus && ./bplus
+#include "Eset.hpp"
+#include "Eset_bplus.hpp"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <vector>
+
+using namespace std;
+using namespace chrono;
+
+const size_t TEST_SIZE = 1'000'000;
+const int RANDOM_SEED = 111;
+const int WARMUP_RUNS = 1;
+const int TEST_RUNS = 5;
+
+enum { INSERT, FIND, FORWARD, BACKWARD, ERASE, OPS };
+const char *const OP_NAMES[OPS] = {"Insert", "Find", "Forward Iteration",
+                                   "Backward Iteration", "Erase"};
+
+template <typename Func> double elapsed_ms(Func &&func) {
+  auto start = steady_clock::now();
+  func();
+  return duration<double, milli>(steady_clock::now() - start).count();
+}
+
+// One full pass: insert, find, iterate both ways, erase
+template <typename SetType> void run_once(const vector<int> &data, double *ms) {
+  SetType s;
+  volatile size_t sink = 0;
+  ms[INSERT] = elapsed_ms([&] {
+    for (int x : data)
+      s.emplace(x);
+  });
+  ms[FIND] = elapsed_ms([&] {
+    for (int x : data)
+      sink = sink + (s.find(x) != s.end());
+  });
+  ms[FORWARD] = elapsed_ms([&] {
+    size_t count = 0;
+    for (auto it = s.begin(); it != s.end(); ++it)
+      count++;
+    sink = count;
+  });
+  ms[BACKWARD] = elapsed_ms([&] {
+    size_t count = 0;
+    for (auto it = s.end(); it != s.begin();) {
+      --it;
+      count++;
+    }
+    sink = count;
+  });
+  ms[ERASE] = elapsed_ms([&] {
+    for (int x : data)
+      s.erase(x);
+  });
+}
+
+// Mean over TEST_RUNS passes after WARMUP_RUNS untimed ones
+template <typename SetType> void benchmark(const vector<int> &data,
+                                           double *mean) {
+  double ms[OPS];
+  for (int i = 0; i < WARMUP_RUNS; ++i)
+    run_once<SetType>(data, ms);
+  fill(mean, mean + OPS, 0.0);
+  for (int i = 0; i < TEST_RUNS; ++i) {
+    run_once<SetType>(data, ms);
+    for (int op = 0; op < OPS; ++op)
+      mean[op] += ms[op] / TEST_RUNS;
+  }
+}
+
+int main() {
+  vector<int> data(TEST_SIZE);
+  mt19937 rng(RANDOM_SEED);
+  uniform_int_distribution<int> dist(1, INT_MAX);
+  generate(data.begin(), data.end(), [&]() { return dist(rng); });
+
+  double std_ms[OPS], eset_ms[OPS], bplus_ms[OPS];
+  benchmark<set<int>>(data, std_ms);
+  benchmark<ESet<int>>(data, eset_ms);
+  benchmark<BPlusESet<int>>(data, bplus_ms);
+
+  printf("%-20s %12s %12s %12s\n", "Operation (ms)", "std::set", "ESet",
+         "BPlusESet");
+  for (int op = 0; op < OPS; ++op)
+    printf("%-20s %12.2f %12.2f %12.2f\n", OP_NAMES[op], std_ms[op],
+           eset_ms[op], bplus_ms[op]);
+  return 0;
+}
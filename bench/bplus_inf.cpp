@@ -0,0 +1,70 @@
+// Regression check for BPlusESet<double> with infinite keys: padding slots
+// must never be mistaken for keys.
+//
+//   g++ -std=c++20 -O1 -g -fsanitize=address,undefined -Iinclude \
+//       bench/bplus_inf.cpp -o bplus_inf && ./bplus_inf
+#include "Eset_bplus.hpp"
+#include <cstdio>
+#include <limits>
+#include <set>
+
+using namespace std;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    ++failures;
+  }
+}
+
+// Same contents in the same order as the reference set
+static bool same(const BPlusESet<double> &s, const set<double> &ref) {
+  if (s.size() != ref.size())
+    return false;
+  auto it = ref.begin();
+  for (double x : s)
+    if (x != *it++)
+      return false;
+  return true;
+}
+
+int main() {
+  const double inf = numeric_limits<double>::infinity();
+  BPlusESet<double> s;
+  set<double> ref;
+
+  // Enough keys for several leaves and an inner level
+  for (int i = 0; i < 1000; ++i) {
+    s.emplace(i * 0.5);
+    ref.insert(i * 0.5);
+  }
+  check(s.find(inf) == s.end(), "find(inf) on a set without inf");
+  check(s.lower_bound(inf) == s.end(), "lower_bound(inf) without inf");
+  check(s.upper_bound(inf) == s.end(), "upper_bound(inf) without inf");
+  check(s.range(5, inf) == 990, "range(5, inf) without inf");
+  check(s.range(-inf, inf) == 1000, "range(-inf, inf) without inf");
+
+  check(s.emplace(inf).second, "emplace(inf)");
+  check(s.emplace(-inf).second, "emplace(-inf)");
+  check(!s.emplace(inf).second, "emplace(inf) twice");
+  ref.insert(inf);
+  ref.insert(-inf);
+  check(same(s, ref), "contents after emplace(+-inf)");
+  check(s.find(inf) != s.end() && *s.find(inf) == inf, "find(inf)");
+  check(*s.lower_bound(inf) == inf, "lower_bound(inf)");
+  check(s.upper_bound(inf) == s.end(), "upper_bound(inf)");
+  check(s.range(5, inf) == 991, "range(5, inf)");
+  check(s.range(-inf, inf) == 1002, "range(-inf, inf)");
+
+  check(s.erase(inf) == 1, "erase(inf)");
+  check(s.erase(inf) == 0, "erase(inf) twice");
+  ref.erase(inf);
+  check(same(s, ref), "contents after erase(inf)");
+  check(s.find(inf) == s.end(), "find(inf) after erase");
+
+  if (!failures)
+    printf("BPlusESet handles infinite keys\n");
+  return failures ? 1 : 0;
+}
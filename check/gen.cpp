@@ -0,0 +1,65 @@
+// Random command stream for code.cpp, used by check/parallel.sh.
+//   gen <seed> <commands> [versions]
+// Versions are created with op 0 on fresh indices and op 2 copies up to
+// roughly the given count; ops 5/6 are rare so batches stay well above
+// replayParallel's MIN_PARALLEL. A few commands use negative or
+// out-of-range versions, but only for ops that check them (3, 7, 8, 9).
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::fprintf(stderr, "usage: %s <seed> <commands> [versions]\n", argv[0]);
+    return 2;
+  }
+  std::mt19937_64 rng(std::strtoull(argv[1], nullptr, 10));
+  long long n = std::strtoll(argv[2], nullptr, 10);
+  long long target = argc > 3 ? std::strtoll(argv[3], nullptr, 10) : 2000;
+  long long versions = 1;
+  const long long KEYS = 1000;
+
+  auto pick = [&](long long m) { return (long long)(rng() % m); };
+  // Mostly existing versions, sometimes one that does not exist
+  auto version = [&]() {
+    switch (pick(200)) {
+    case 0:
+      return -1 - pick(5);
+    case 1:
+      return versions + pick(5);
+    default:
+      return pick(versions);
+    }
+  };
+
+  for (long long i = 0; i < n; ++i) {
+    long long r = pick(10000);
+    if (r < 3500) {
+      long long a = versions < target && !pick(50) ? versions++ : pick(versions);
+      std::printf("0 %lld %lld\n", a, pick(KEYS));
+    } else if (r < 5500) {
+      std::printf("1 %lld %lld\n", pick(versions), pick(KEYS));
+    } else if (r < 5700) {
+      if (versions < target) {
+        std::printf("2 %lld\n", pick(versions));
+        ++versions;
+      } else {
+        std::printf("7 %lld\n", version());
+      }
+    } else if (r < 7700) {
+      std::printf("3 %lld %lld\n", version(), pick(KEYS));
+    } else if (r < 9200) {
+      long long l = pick(KEYS);
+      std::printf("4 %lld %lld %lld\n", pick(versions), l, l + pick(KEYS / 4));
+    } else if (r < 9500) {
+      std::printf("8 %lld %lld\n", version(), version());
+    } else if (r < 9800) {
+      std::printf("9 %lld %lld\n", version(), version());
+    } else if (r < 9997) {
+      std::printf("7 %lld\n", version());
+    } else {
+      std::printf("%d\n", 5 + int(pick(2)));
+    }
+  }
+  return 0;
+}
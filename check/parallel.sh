@@ -0,0 +1,42 @@
+#!/bin/sh
+# Compare code.cpp built with ESET_PARALLEL=1 against the sequential build
+# on random command streams (check/gen.cpp), as text and as a binary log.
+#   check/parallel.sh [seeds] [commands]     run from the repository root
+# SANITIZE=thread (or address) builds the parallel binary with that
+# sanitizer; CXX overrides the compiler.
+set -eu
+
+SEEDS=${1:-20}
+COMMANDS=${2:-300000}
+CXX=${CXX:-g++}
+FLAGS="-std=c++20 -O2 -pthread -Iinclude"
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+$CXX -std=c++20 -O2 check/gen.cpp -o "$OUT/gen"
+$CXX $FLAGS code.cpp -o "$OUT/seq"
+if [ -n "${SANITIZE:-}" ]; then
+  $CXX $FLAGS -g -fsanitize="$SANITIZE" -DESET_PARALLEL=1 code.cpp \
+    -o "$OUT/par"
+else
+  $CXX $FLAGS -DESET_PARALLEL=1 code.cpp -o "$OUT/par"
+fi
+
+seed=1
+while [ "$seed" -le "$SEEDS" ]; do
+  versions=$((seed * 500))
+  "$OUT/gen" "$seed" "$COMMANDS" "$versions" > "$OUT/in.txt"
+  "$OUT/seq" --to-binary < "$OUT/in.txt" > "$OUT/in.bin"
+  "$OUT/seq" < "$OUT/in.txt" > "$OUT/expected"
+  for threads in 2 4 8; do
+    for input in in.txt in.bin; do
+      ESET_THREADS=$threads "$OUT/par" < "$OUT/$input" > "$OUT/actual"
+      if ! cmp -s "$OUT/expected" "$OUT/actual"; then
+        echo "seed $seed, $threads threads, $input: output differs"
+        exit 1
+      fi
+    done
+  done
+  seed=$((seed + 1))
+done
+echo "parallel replay matches sequential on $SEEDS seeds"
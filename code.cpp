@@ -1,39 +1,333 @@
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <ctime>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <random>
 #include <stack>
+#include <thread>
 #include <utility>
 #include <vector>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <unistd.h>
+
+// ESET_PARALLEL=1 时按版本把命令分给多个线程执行（线程数由环境变量
+// ESET_THREADS 指定，默认取 CPU 核数），节点引用计数改为原子操作，
+// 内存池使用线程缓存，随机数发生器每个线程一份
+#ifndef ESET_PARALLEL
+#define ESET_PARALLEL 0
+#endif
+
+#ifndef NODEPOOL_THREAD_CACHE
+#define NODEPOOL_THREAD_CACHE ESET_PARALLEL
+#endif
+
+#if ESET_PARALLEL && !NODEPOOL_THREAD_CACHE
+#error "ESET_PARALLEL requires NODEPOOL_THREAD_CACHE"
+#endif
+
+// ESET_CANONICAL=1 时节点优先级由关键字的散列决定，同一组关键字总是同一
+// 形状的 treap；每个节点记录子树散列，相同的子树只保留一份，
+// 两个版本内容相同当且仅当根指针相同
+#ifndef ESET_CANONICAL
+#define ESET_CANONICAL 0
+#endif
+
+#if ESET_CANONICAL && ESET_PARALLEL
+#error "ESET_CANONICAL does not support ESET_PARALLEL"
+#endif
+
+#if ESET_PARALLEL
+static thread_local std::mt19937
+    rng(std::chrono::steady_clock::now().time_since_epoch().count());
+typedef std::atomic<int> RefCount;
+#else
 static std::mt19937
     rng(std::chrono::steady_clock::now().time_since_epoch().count());
+typedef int RefCount;
+#endif
 
 typedef long long ll;
+
+// 节点内存池：请求大小按 16 字节分级，每个 64KB 块只切一种大小的槽，
+// 块内有自己的空闲链表和存活计数。释放的节点回到所在块的空闲链表，
+// 块完全空闲时归还给操作系统（每级保留一个空块，避免反复申请）。
+// NODEPOOL_THREAD_CACHE=1 时每个线程为每一级缓存一批空闲槽，
+// 只在批量取用/归还时加锁访问共享的块层。
 class NodePool {
+public:
+  struct Stats {
+    size_t live_bytes;      // 已分配给节点的槽（含线程缓存中的槽）
+    size_t peak_live_bytes; // live_bytes 的历史最高值
+    size_t os_bytes;        // 当前向操作系统申请的块
+    size_t peak_os_bytes;   // os_bytes 的历史最高值
+  };
+
 private:
-  static const size_t BLOCK_SIZE = 1 << 20;
-  std::vector<char *> blocks;
-  char *current_block;
-  size_t current_pos;
+  static const size_t BLOCK_SIZE = 1 << 16;
+  static const size_t ALIGN = 16;
+  static const size_t NUM_CLASSES = 16; // 16, 32, ..., 256 字节
+  static const size_t MAX_SMALL = ALIGN * NUM_CLASSES;
+
+  struct FreeSlot {
+    FreeSlot *next;
+  };
+
+  // 块头，位于块的起始处；块按 BLOCK_SIZE 对齐，槽地址取整即得块头
+  struct Block {
+    Block *prev, *next;  // 所在级别的未满块链表
+    FreeSlot *free_list; // 块内已释放的槽
+    char *bump;          // 尚未切分部分的起点
+    size_t live;         // 已分配出去的槽数
+    size_t cls;
+    bool listed; // 是否在未满块链表中
+  };
+
+  static const size_t HEADER_SIZE = (sizeof(Block) + ALIGN - 1) / ALIGN * ALIGN;
+
+  struct SizeClass {
+    Block *partial;      // 还有空位的块
+    size_t empty_blocks; // live == 0 的块数
+  };
+
+  SizeClass classes[NUM_CLASSES];
+  Stats stats_;
+
+  static size_t slotSize(size_t cls) { return (cls + 1) * ALIGN; }
+
+  static Block *blockOf(void *p) {
+    return reinterpret_cast<Block *>(reinterpret_cast<uintptr_t>(p) &
+                                     ~(uintptr_t)(BLOCK_SIZE - 1));
+  }
+
+  static bool full(const Block *b) {
+    return !b->free_list && b->bump + slotSize(b->cls) >
+                                reinterpret_cast<const char *>(b) + BLOCK_SIZE;
+  }
+
+  void link(Block *b) {
+    SizeClass &c = classes[b->cls];
+    b->prev = nullptr;
+    b->next = c.partial;
+    if (c.partial)
+      c.partial->prev = b;
+    c.partial = b;
+    b->listed = true;
+  }
+
+  void unlink(Block *b) {
+    SizeClass &c = classes[b->cls];
+    if (b->prev)
+      b->prev->next = b->next;
+    else
+      c.partial = b->next;
+    if (b->next)
+      b->next->prev = b->prev;
+    b->listed = false;
+  }
+
+  // 申请一个按 BLOCK_SIZE 对齐的块：多映射一个块的长度，再裁掉两端
+  Block *newBlock(size_t cls) {
+    void *mem;
+#if defined(__linux__)
+    char *raw = static_cast<char *>(mmap(nullptr, 2 * BLOCK_SIZE,
+                                         PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (raw == MAP_FAILED)
+      throw std::bad_alloc();
+    char *aligned = reinterpret_cast<char *>(
+        (reinterpret_cast<uintptr_t>(raw) + BLOCK_SIZE - 1) &
+        ~(uintptr_t)(BLOCK_SIZE - 1));
+    if (aligned > raw)
+      munmap(raw, aligned - raw);
+    munmap(aligned + BLOCK_SIZE, raw + BLOCK_SIZE - aligned);
+    mem = aligned;
+#else
+    mem = std::aligned_alloc(BLOCK_SIZE, BLOCK_SIZE);
+    if (!mem)
+      throw std::bad_alloc();
+#endif
+    Block *b = static_cast<Block *>(mem);
+    b->free_list = nullptr;
+    b->bump = static_cast<char *>(mem) + HEADER_SIZE;
+    b->live = 0;
+    b->cls = cls;
+    link(b);
+    ++classes[cls].empty_blocks;
+    stats_.os_bytes += BLOCK_SIZE;
+    if (stats_.os_bytes > stats_.peak_os_bytes)
+      stats_.peak_os_bytes = stats_.os_bytes;
+    return b;
+  }
+
+  void releaseBlock(Block *b) {
+    if (b->listed)
+      unlink(b);
+    stats_.os_bytes -= BLOCK_SIZE;
+#if defined(__linux__)
+    munmap(b, BLOCK_SIZE);
+#else
+    std::free(b);
+#endif
+  }
+
+  void *takeSlot(size_t cls) {
+    SizeClass &c = classes[cls];
+    Block *b = c.partial ? c.partial : newBlock(cls);
+    void *p;
+    if (b->free_list) {
+      p = b->free_list;
+      b->free_list = b->free_list->next;
+    } else {
+      p = b->bump;
+      b->bump += slotSize(cls);
+    }
+    if (b->live++ == 0)
+      --c.empty_blocks;
+    if (full(b))
+      unlink(b);
+    stats_.live_bytes += slotSize(cls);
+    if (stats_.live_bytes > stats_.peak_live_bytes)
+      stats_.peak_live_bytes = stats_.live_bytes;
+    return p;
+  }
+
+  void putSlot(void *p) {
+    Block *b = blockOf(p);
+    SizeClass &c = classes[b->cls];
+    FreeSlot *slot = static_cast<FreeSlot *>(p);
+    slot->next = b->free_list;
+    b->free_list = slot;
+    stats_.live_bytes -= slotSize(b->cls);
+    if (--b->live == 0) {
+      if (c.empty_blocks) {
+        releaseBlock(b);
+        return;
+      }
+      ++c.empty_blocks;
+    }
+    if (!b->listed)
+      link(b);
+  }
+
+#if NODEPOOL_THREAD_CACHE
+  static const size_t CACHE_BATCH = 64;
+
+  // 可平凡析构，线程退出时由 Flusher 归还后仍可安全访问
+  struct ThreadCache {
+    FreeSlot *head[NUM_CLASSES];
+    size_t count[NUM_CLASSES];
+    bool closed;
+  };
+
+  struct Flusher {
+    NodePool &pool;
+    ThreadCache &cache;
+    ~Flusher() {
+      std::lock_guard<std::mutex> guard(pool.lock);
+      for (size_t cls = 0; cls < NUM_CLASSES; ++cls)
+        while (FreeSlot *slot = cache.head[cls]) {
+          cache.head[cls] = slot->next;
+          pool.putSlot(slot);
+        }
+      cache.closed = true;
+    }
+  };
+
+  std::mutex lock;
+
+  ThreadCache &cache() {
+    thread_local ThreadCache c{};
+    thread_local Flusher flusher{*this, c};
+    (void)flusher;
+    return c;
+  }
+#endif
 
 public:
-  NodePool() : current_block(nullptr), current_pos(0) {}
+  NodePool() : classes(), stats_() {}
+
+  // 仍被占用的块在进程退出时交给操作系统回收
   ~NodePool() {
-    for (char *block : blocks) {
-      delete[] block;
-    }
+    for (SizeClass &c : classes)
+      while (c.partial && !c.partial->live)
+        releaseBlock(c.partial);
   }
 
   void *allocate(size_t size) {
-    if (!current_block || current_pos + size > BLOCK_SIZE) {
-      current_block = new char[BLOCK_SIZE];
-      blocks.push_back(current_block);
-      current_pos = 0;
+    if (size > MAX_SMALL)
+      return ::operator new(size);
+    size_t cls = (size + ALIGN - 1) / ALIGN - 1;
+#if NODEPOOL_THREAD_CACHE
+    ThreadCache &c = cache();
+    if (!c.head[cls]) {
+      std::lock_guard<std::mutex> guard(lock);
+      if (c.closed)
+        return takeSlot(cls);
+      for (size_t i = 0; i < CACHE_BATCH; ++i) {
+        FreeSlot *slot = static_cast<FreeSlot *>(takeSlot(cls));
+        slot->next = c.head[cls];
+        c.head[cls] = slot;
+      }
+      c.count[cls] += CACHE_BATCH;
+    }
+    FreeSlot *slot = c.head[cls];
+    c.head[cls] = slot->next;
+    --c.count[cls];
+    return slot;
+#else
+    return takeSlot(cls);
+#endif
+  }
+
+  void deallocate(void *p, size_t size) {
+    if (size > MAX_SMALL) {
+      ::operator delete(p);
+      return;
+    }
+#if NODEPOOL_THREAD_CACHE
+    ThreadCache &c = cache();
+    size_t cls = (size + ALIGN - 1) / ALIGN - 1;
+    if (c.closed) {
+      std::lock_guard<std::mutex> guard(lock);
+      putSlot(p);
+      return;
+    }
+    FreeSlot *slot = static_cast<FreeSlot *>(p);
+    slot->next = c.head[cls];
+    c.head[cls] = slot;
+    // 缓存超过两批时归还一批
+    if (++c.count[cls] == 2 * CACHE_BATCH) {
+      std::lock_guard<std::mutex> guard(lock);
+      for (size_t i = 0; i < CACHE_BATCH; ++i) {
+        slot = c.head[cls];
+        c.head[cls] = slot->next;
+        putSlot(slot);
+      }
+      c.count[cls] -= CACHE_BATCH;
     }
-    void *ptr = current_block + current_pos;
-    current_pos += size;
-    return ptr;
+#else
+    putSlot(p);
+#endif
+  }
+
+  Stats stats() {
+#if NODEPOOL_THREAD_CACHE
+    std::lock_guard<std::mutex> guard(lock);
+#endif
+    return stats_;
   }
 };
 
@@ -44,16 +338,20 @@ private:
   // Treap 节点定义，带有引用计数以支持持久化
   struct Node {
     ll key;             // 关键字
-    int priority;       // Treap 随机优先级
     Node *left, *right; // 左右子节点
-    int ref_count;      // 引用计数，用于持久化
     size_t size_;       // 当前子树的大小
+#if ESET_CANONICAL
+    uint64_t hash; // 子树散列，由关键字和左右子树散列算出
+#endif
+    int priority;       // Treap 优先级
+    RefCount ref_count; // 引用计数，用于持久化
 
     Node(ll k)
-        : key(k), priority(rng()), left(nullptr), right(nullptr), ref_count(1),
-          size_(1) {}
+        : key(k), left(nullptr), right(nullptr), size_(1),
+          priority(priorityOf(k)), ref_count(1) {}
     Node(ll key, int priority, Node *left, Node *right)
-        : key(key), priority(priority), left(left), right(right), ref_count(1) {
+        : key(key), left(left), right(right), priority(priority),
+          ref_count(1) {
       size_ = 1;
       if (left)
         ++left->ref_count, size_ += left->size_;
@@ -64,115 +362,325 @@ private:
       return global_node_pool.allocate(size);
     }
 
-    static void operator delete(void *) {
-      // 内存池不实际释放内存
+    static void operator delete(void *p, size_t size) {
+      global_node_pool.deallocate(p, size);
     }
   };
 
   Node *root;
   size_t tree_size;
 
-  // 合并两个 Treap，返回合并后的根节点
-  // 保持 Treap 的平衡和二叉搜索树性质
-  Node *merge(Node *left, Node *right) {
-    if (!left) {
-      return right;
+  // 写操作的引用计数约定：
+  // 每个节点的 ref_count 等于指向它的父节点指针数加上以它为根的集合数。
+  // 递归函数收到节点 x 和标志 own：own 为真表示调用方独占指向 x 的那个引用
+  // 且 x->ref_count == 1，此时可以原地修改 x，这个引用随之交给函数；
+  // own 为假时 x 被其他版本共享，只读不改，需要修改时复制。
+  // 返回的指针都已经计入一个引用，由调用方接管。
+  // 所有修改都在递归返回时进行，中途发现重复/缺失的关键字时树保持原样。
+  // 放掉对共享节点的引用一律经过 clear：并行执行时别的版本可能同时放掉
+  // 它的引用，计数可能在这里归零。
+  // 规范模式下节点登记进散列表后不再修改，所有写操作都走复制路径。
+
+  static size_t sizeOf(Node *node) { return node ? node->size_ : 0; }
+
+  static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  // 新节点的优先级：规范模式下取关键字的散列，否则随机
+  static int priorityOf(ll key) {
+#if ESET_CANONICAL
+    return int(mix(key) >> 32);
+#else
+    (void)key;
+    return rng();
+#endif
+  }
+
+  // 优先级为 priority、关键字为 key 的节点是否应位于 node 之上；
+  // 优先级相同时关键字小的在上，保证形状只由关键字集合决定
+  static bool above(int priority, ll key, const Node *node) {
+    return priority > node->priority ||
+           (priority == node->priority && key < node->key);
+  }
+
+#if ESET_CANONICAL
+  // 所有节点的开放寻址散列表（线性探测，不持有引用）。节点的孩子都已
+  // 登记，所以关键字和左右孩子指针都相同的节点就是内容相同的子树
+  class InternTable {
+  private:
+    std::vector<Node *> slots;
+    size_t used;
+
+    static bool same(const Node *x, const Node *y) {
+      return x->hash == y->hash && x->key == y->key && x->left == y->left &&
+             x->right == y->right;
     }
-    if (!right) {
-      return left;
+
+    void grow() {
+      std::vector<Node *> old(slots.empty() ? 1024 : slots.size() * 2);
+      old.swap(slots);
+      size_t mask = slots.size() - 1;
+      for (Node *x : old)
+        if (x) {
+          size_t i = x->hash & mask;
+          while (slots[i])
+            i = (i + 1) & mask;
+          slots[i] = x;
+        }
+    }
+
+  public:
+    InternTable() : used(0) {}
+
+    // 返回与 x 内容相同的已登记节点；没有则登记 x 并返回 x
+    Node *intern(Node *x) {
+      if (2 * (used + 1) > slots.size())
+        grow();
+      size_t mask = slots.size() - 1;
+      size_t i = x->hash & mask;
+      for (; slots[i]; i = (i + 1) & mask)
+        if (same(slots[i], x))
+          return slots[i];
+      slots[i] = x;
+      ++used;
+      return x;
     }
 
-    if (left->priority > right->priority) {
-      left->right = merge(left->right, right);
-      left->size_ = 1 + (left->left ? left->left->size_ : 0) +
-                    (left->right ? left->right->size_ : 0);
-      return left;
+    // 注销 x，后面的探测链往前移，不留墓碑
+    void erase(Node *x) {
+      size_t mask = slots.size() - 1;
+      size_t j = x->hash & mask;
+      while (slots[j] != x)
+        j = (j + 1) & mask;
+      for (size_t i = (j + 1) & mask; slots[i]; i = (i + 1) & mask) {
+        size_t home = slots[i]->hash & mask;
+        // home 不在 (j, i] 内时，slots[i] 可以挪到空出的 j
+        if ((i > j && (home <= j || home > i)) ||
+            (i < j && home <= j && home > i)) {
+          slots[j] = slots[i];
+          j = i;
+        }
+      }
+      slots[j] = nullptr;
+      --used;
+    }
+  };
+
+  static InternTable &interned() {
+    // 不析构：集合可能在静态析构阶段才释放节点
+    static InternTable *table = new InternTable;
+    return *table;
+  }
+#endif
+
+  // 节点 x 的内容已经确定：规范模式下算出子树散列并登记，已有相同的
+  // 节点时放掉 x，改为引用那个节点
+  static Node *seal(Node *x) {
+#if ESET_CANONICAL
+    x->hash = mix(mix(x->key) ^
+                  (x->left ? x->left->hash * 0x9e3779b97f4a7c15ULL : 0) ^
+                  (x->right ? x->right->hash + 0x632be59bd9b4e019ULL : 0));
+    Node *same = interned().intern(x);
+    if (same != x) {
+      ++same->ref_count;
+      clear(x->left);
+      clear(x->right);
+      delete x;
+    }
+    return same;
+#else
+    return x;
+#endif
+  }
+
+  // 删除引用计数已归零的节点
+  static void dispose(Node *x) {
+#if ESET_CANONICAL
+    interned().erase(x);
+#endif
+    delete x;
+  }
+
+  // 孩子 child 能否原地修改：父节点可改且 child 只被父节点引用
+  static bool owned(bool own, Node *child) {
+#if ESET_CANONICAL
+    (void)own;
+    (void)child;
+    return false;
+#else
+    return own && child && child->ref_count == 1;
+#endif
+  }
+
+  // 把 x 的一个孩子槽 slot（原来指向 old_child，它的可改标志为
+  // child_own）换成 new_child，子树大小变化 delta，返回可以修改的 x 或
+  // x 的副本（规范模式下可能是已有的相同节点）。大小按差值更新，
+  // 不必读取路径外的兄弟节点
+  static Node *replaceChild(Node *x, bool own, Node *Node::*slot,
+                            Node *old_child, bool child_own, Node *new_child,
+                            ll delta) {
+    size_t size = x->size_ + delta;
+    if (own) {
+      // 共享的旧孩子少了 x 这个引用；独占的旧孩子已交给递归
+      if (old_child && !child_own)
+        clear(old_child);
+    } else {
+      x = new Node(x->key, x->priority, x->left, x->right);
+      if (old_child)
+        --old_child->ref_count;
+    }
+    x->*slot = new_child;
+    x->size_ = size;
+    return seal(x);
+  }
+
+  // 返回指向 node 的一个新引用（own 时直接沿用调用方的引用）
+  static Node *share(Node *node, bool own) {
+    if (node && !own)
+      ++node->ref_count;
+    return node;
+  }
+
+  // 合并 left 与 right（left 中的关键字都小于 right），
+  // 只复制两条相接的边界路径上的共享节点
+  Node *merge(Node *left, bool own_l, Node *right, bool own_r) {
+    if (!left)
+      return share(right, own_r);
+    if (!right)
+      return share(left, own_l);
+
+    if (!above(right->priority, right->key, left)) {
+      Node *child = left->right;
+      bool child_own = owned(own_l, child);
+      ll added = right->size_;
+      Node *merged = merge(child, child_own, right, own_r);
+      return replaceChild(left, own_l, &Node::right, child, child_own, merged,
+                          added);
     } else {
-      right->left = merge(left, right->left);
-      right->size_ = 1 + (right->left ? right->left->size_ : 0) +
-                     (right->right ? right->right->size_ : 0);
-      return right;
+      Node *child = right->left;
+      bool child_own = owned(own_r, child);
+      ll added = left->size_;
+      Node *merged = merge(left, own_l, child, child_own);
+      return replaceChild(right, own_r, &Node::left, child, child_own, merged,
+                          added);
     }
   }
 
-  // split_lower: 将所有严格小于 key 的节点分到左子树，其他分到右子树
-  // 用于插入、删除等操作时分割 Treap
-  void split_lower(Node *node, ll key, Node *&left_, Node *&right_) {
+  // 按 key 把 node 分成小于 key 的 left_ 和大于 key 的 right_；
+  // 若 key 已存在则返回 false 且不做任何修改
+  bool split(Node *node, bool own, ll key, Node *&left_, Node *&right_) {
     if (!node) {
       left_ = right_ = nullptr;
-      return;
+      return true;
     }
+    if (node->key == key)
+      return false;
     if (node->key < key) {
-      if (node->ref_count == 0) {
-        left_ = node;
-        ++node->ref_count;
-        if (node->right)
-          --node->right->ref_count;
-      } else {
-        left_ = new Node(node->key, node->priority, node->left, nullptr);
-      }
-      split_lower(node->right, key, left_->right, right_);
-      left_->size_ = 1 + (left_->left ? left_->left->size_ : 0) +
-                     (left_->right ? left_->right->size_ : 0);
+      Node *child = node->right;
+      bool child_own = owned(own, child);
+      ll old_size = sizeOf(child);
+      Node *rest;
+      if (!split(child, child_own, key, rest, right_))
+        return false;
+      left_ = replaceChild(node, own, &Node::right, child, child_own, rest,
+                           (ll)sizeOf(rest) - old_size);
     } else {
-      if (node->ref_count == 0) {
-        right_ = node;
-        ++node->ref_count;
-        if (node->left)
-          --node->left->ref_count;
-      } else {
-        right_ = new Node(node->key, node->priority, nullptr, node->right);
-      }
-      split_lower(node->left, key, left_, right_->left);
-      right_->size_ = 1 + (right_->left ? right_->left->size_ : 0) +
-                      (right_->right ? right_->right->size_ : 0);
+      Node *child = node->left;
+      bool child_own = owned(own, child);
+      ll old_size = sizeOf(child);
+      Node *rest;
+      if (!split(child, child_own, key, left_, rest))
+        return false;
+      right_ = replaceChild(node, own, &Node::left, child, child_own, rest,
+                            (ll)sizeOf(rest) - old_size);
     }
+    return true;
   }
 
-  // split_greater: 将所有大于等于 key 的节点分到右子树，其他分到左子树
-  // 用于范围查询的右边界分割
-  void split_greater(Node *node, ll key, Node *&left_, Node *&right_) {
+  // 沿 key 的查找路径下降，在第一个优先级低于 priority 的位置把该子树
+  // 分裂到新节点的两侧；关键字已存在时返回 nullptr
+  Node *insert(Node *node, bool own, ll key, int priority) {
+    if (!node || above(priority, key, node)) {
+      Node *left_, *right_;
+      if (!split(node, own, key, left_, right_))
+        return nullptr;
+      Node *z = new Node(key, priority, nullptr, nullptr);
+      z->left = left_;
+      z->right = right_;
+      z->size_ = 1 + sizeOf(left_) + sizeOf(right_);
+      return seal(z);
+    }
+    if (node->key == key)
+      return nullptr;
+    Node *Node::*slot = key < node->key ? &Node::left : &Node::right;
+    Node *child = node->*slot;
+    bool child_own = owned(own, child);
+    Node *result = insert(child, child_own, key, priority);
+    if (!result)
+      return nullptr;
+    return replaceChild(node, own, slot, child, child_own, result, 1);
+  }
+
+  // 删除 key：找到目标后只合并它的两个孩子；不存在时 found 为 false
+  Node *remove(Node *node, bool own, ll key, bool &found) {
     if (!node) {
-      left_ = right_ = nullptr;
-      return;
+      found = false;
+      return nullptr;
     }
-    if (key >= node->key) {
-      if (node->ref_count == 0) {
-        left_ = node;
-        ++node->ref_count;
-        if (node->right)
-          --node->right->ref_count;
-      } else {
-        left_ = new Node(node->key, node->priority, node->left, nullptr);
+    if (node->key == key) {
+      found = true;
+      Node *left = node->left, *right = node->right;
+      bool own_l = owned(own, left), own_r = owned(own, right);
+      Node *merged = merge(left, own_l, right, own_r);
+      if (own) {
+        // 目标节点只属于本集合：放掉它对共享孩子的引用后释放
+        if (left && !own_l)
+          clear(left);
+        if (right && !own_r)
+          clear(right);
+        dispose(node);
       }
-      split_greater(node->right, key, left_->right, right_);
-      left_->size_ = 1 + (left_->left ? left_->left->size_ : 0) +
-                     (left_->right ? left_->right->size_ : 0);
-    } else {
-      if (node->ref_count == 0) {
-        right_ = node;
-        ++node->ref_count;
-        if (node->left)
-          --node->left->ref_count;
-      } else {
-        right_ = new Node(node->key, node->priority, nullptr, node->right);
-      }
-      split_greater(node->left, key, left_, right_->left);
-      right_->size_ = 1 + (right_->left ? right_->left->size_ : 0) +
-                      (right_->right ? right_->right->size_ : 0);
+      return merged;
     }
+    Node *Node::*slot = key < node->key ? &Node::left : &Node::right;
+    Node *child = node->*slot;
+    bool child_own = owned(own, child);
+    Node *result = remove(child, child_own, key, found);
+    if (!found)
+      return nullptr;
+    return replaceChild(node, own, slot, child, child_own, result, -1);
   }
 
   // 递归释放节点，引用计数为0时删除节点
-  void clear(Node *node) {
+  static void clear(Node *node) {
     if (node && --node->ref_count == 0) {
       clear(node->left);
       clear(node->right);
-      delete node;
+      dispose(node);
       node = nullptr;
     }
   }
 
+  // 小于 key（inclusive 时为不大于 key）的元素个数，沿一条路径累加左子树大小
+  size_t countLess(ll key, bool inclusive) const {
+    size_t cnt = 0;
+    Node *node = root;
+    while (node) {
+      if (node->key < key || (inclusive && node->key == key)) {
+        cnt += 1 + (node->left ? node->left->size_ : 0);
+        node = node->right;
+      } else {
+        node = node->left;
+      }
+    }
+    return cnt;
+  }
+
   // 更新当前集合的最小值和最大值
 
   void updateMin() {
@@ -193,6 +701,54 @@ private:
     maxK = curr->key;
   }
 
+  // diff 的游标项：整棵子树，或者单个节点的关键字。子树的关键字都在
+  // 祖先确定的开区间 (lo, hi) 内，has_lo/has_hi 为假表示那一侧无界
+  struct DiffItem {
+    Node *node;
+    bool whole;
+    bool has_lo, has_hi;
+    ll lo, hi;
+  };
+
+  // p 的关键字是否全都小于 q 的关键字
+  static bool before(const DiffItem &p, const DiffItem &q) {
+    if (!p.whole && !q.whole)
+      return p.node->key < q.node->key;
+    if (!p.whole)
+      return q.has_lo && p.node->key <= q.lo;
+    if (!q.whole)
+      return p.has_hi && p.hi <= q.node->key;
+    return p.has_hi && q.has_lo && p.hi <= q.lo;
+  }
+
+  // 把栈顶的子树换成它的左子树、根的关键字、右子树（左子树在栈顶）
+  static void expand(std::vector<DiffItem> &stack) {
+    DiffItem top = stack.back();
+    Node *x = top.node;
+    stack.pop_back();
+    if (x->right)
+      stack.push_back({x->right, true, true, top.has_hi, x->key, top.hi});
+    stack.push_back({x, false, false, false, 0, 0});
+    if (x->left)
+      stack.push_back({x->left, true, top.has_lo, true, top.lo, x->key});
+  }
+
+  // 按中序把项里的关键字追加到 keys
+  static void collect(const DiffItem &item, std::vector<ll> &keys) {
+    if (!item.whole) {
+      keys.push_back(item.node->key);
+      return;
+    }
+    std::vector<Node *> path;
+    for (Node *x = item.node; x || !path.empty(); x = x->right) {
+      for (; x; x = x->left)
+        path.push_back(x);
+      x = path.back();
+      path.pop_back();
+      keys.push_back(x->key);
+    }
+  }
+
 public:
   ll minK, maxK;
 
@@ -223,57 +779,51 @@ public:
     root = nullptr;
   }
 
+  // 清空集合，释放只被本集合引用的节点
+  void clear() {
+    clear(root);
+    root = nullptr;
+    tree_size = 0;
+    minK = maxK = 0;
+  }
+
   // 插入元素，若元素已存在返回 false，否则插入并返回 true
   bool emplace(ll key) {
-    if (contains(key))
+    bool own = owned(true, root);
+    Node *result = insert(root, own, key, priorityOf(key));
+    if (!result)
       return false;
+    if (root && !own)
+      clear(root);
+    root = result;
     if (empty()) {
-      root = new Node(key);
       minK = maxK = key;
-      tree_size = 1;
-      return true;
+    } else {
+      if (key < minK)
+        minK = key;
+      if (key > maxK)
+        maxK = key;
     }
-    if (key < minK)
-      minK = key;
-    if (key > maxK)
-      maxK = key;
-    Node *left = nullptr, *right = nullptr;
-    --root->ref_count;
-
-    split_lower(root, key, left, right);
-    Node *new_node = new Node(key);
-    root = merge(merge(left, new_node), right);
     tree_size++;
-
     return true;
   }
 
   // 删除元素，返回删除成功与否（0或1）
   size_t erase(ll key) {
-    if (!contains(key))
+    bool own = owned(true, root);
+    bool found = false;
+    Node *result = remove(root, own, key, found);
+    if (!found)
       return 0;
-    Node *left = nullptr, *mid1 = nullptr, *mid2 = nullptr, *right = nullptr;
-    --root->ref_count;
-
-    split_lower(root, key, left, mid1);
-    if (mid1)
-      --mid1->ref_count;
-
-    split_greater(mid1, key, mid2, right);
-    root = merge(left, right);
-    if (mid2) {
-      tree_size--;
-      clear(mid2);
-      if (key == minK)
-        updateMin();
-      if (key == maxK)
-        updateMax();
-      if (!tree_size)
-        root = nullptr;
-      return 1;
-    } else {
-      return 0;
-    }
+    if (!own)
+      clear(root);
+    root = result;
+    tree_size--;
+    if (key == minK)
+      updateMin();
+    if (key == maxK)
+      updateMax();
+    return 1;
   }
 
   // 判断元素是否存在
@@ -292,20 +842,106 @@ public:
     return false;
   }
 
-  // 统计区间 [l, r] 内元素数量
-  size_t range(ll l, ll r) {
-    if (empty())
+  // 两个集合是否含有相同的元素。规范模式下内容相同的树就是同一棵，
+  // 只比较根指针；否则按中序同时遍历两棵树，跳过两边共享的子树
+  bool equals(const ESet &other) const {
+    if (root == other.root)
+      return true;
+    if (tree_size != other.tree_size)
+      return false;
+#if ESET_CANONICAL
+    return false;
+#else
+    std::vector<Node *> x, y;
+    Node *p = root, *q = other.root;
+    for (;;) {
+      // 两边已经走过同样多的元素，同一棵子树接下来给出的序列也相同
+      if (p == q)
+        p = q = nullptr;
+      for (; p; p = p->left)
+        x.push_back(p);
+      for (; q; q = q->left)
+        y.push_back(q);
+      if (x.empty() || y.empty())
+        return x.empty() && y.empty();
+      p = x.back();
+      q = y.back();
+      x.pop_back();
+      y.pop_back();
+      if (p->key != q->key)
+        return false;
+      p = p->right;
+      q = q->right;
+    }
+#endif
+  }
+
+  // 本集合有而 other 没有的关键字放进 removed，other 有而本集合没有的
+  // 放进 added，都按升序。两个游标按关键字同步前进，栈顶是同一棵子树
+  // 时整棵跳过；只在一侧的整棵子树直接输出；否则展开较大的子树，使共享
+  // 子树在两边同时露到栈顶。版本之间只差 d 条复制路径时代价为 O(d log n)
+  void diff(const ESet &other, std::vector<ll> &removed,
+            std::vector<ll> &added) const {
+    removed.clear();
+    added.clear();
+    std::vector<DiffItem> x, y;
+    if (root)
+      x.push_back({root, true, false, false, 0, 0});
+    if (other.root)
+      y.push_back({other.root, true, false, false, 0, 0});
+    while (!x.empty() && !y.empty()) {
+      const DiffItem &p = x.back(), &q = y.back();
+      if (p.whole && q.whole && p.node == q.node) {
+        x.pop_back();
+        y.pop_back();
+      } else if (!p.whole && !q.whole && p.node->key == q.node->key) {
+        x.pop_back();
+        y.pop_back();
+      } else if (before(p, q)) {
+        collect(p, removed);
+        x.pop_back();
+      } else if (before(q, p)) {
+        collect(q, added);
+        y.pop_back();
+      } else if (p.whole && (!q.whole || p.node->size_ >= q.node->size_)) {
+        expand(x);
+      } else {
+        expand(y);
+      }
+    }
+    for (; !x.empty(); x.pop_back())
+      collect(x.back(), removed);
+    for (; !y.empty(); y.pop_back())
+      collect(y.back(), added);
+  }
+
+  // 统计区间 [l, r] 内元素数量，只读下降，不分裂也不分配节点
+  size_t range(ll l, ll r) const {
+    if (empty() || r < l)
       return 0;
-    Node *left = nullptr, *mid1 = nullptr, *mid2 = nullptr, *right = nullptr;
-    --root->ref_count;
+    return countLess(r, true) - countLess(l, false);
+  }
+
+  // 严格小于 key 的元素个数
+  inline size_t rank(ll key) const { return countLess(key, false); }
 
-    split_lower(root, l, left, mid1);
-    if (mid1)
-      --mid1->ref_count;
-    split_greater(mid1, r, mid2, right);
-    size_t res = mid2 ? mid2->size_ : 0;
-    root = merge(merge(left, mid2), right);
-    return res;
+  // 第 k 小的元素（从 0 开始），不存在返回 -1
+  ll kth(size_t k) const {
+    if (k >= tree_size)
+      return -1;
+    Node *node = root;
+    while (node) {
+      size_t left_size = node->left ? node->left->size_ : 0;
+      if (k < left_size) {
+        node = node->left;
+      } else if (k == left_size) {
+        return node->key;
+      } else {
+        k -= left_size + 1;
+        node = node->right;
+      }
+    }
+    return -1;
   }
 
   // 查找小于 key 的最大元素（前驱），不存在返回 -1
@@ -341,6 +977,358 @@ public:
   inline size_t size() const { return tree_size; }
   inline bool empty() const { return tree_size == 0; }
 };
+// 命令输入：标准输入是普通文件时整体 mmap，否则按块 read
+class FastInput {
+private:
+  static const size_t CHUNK = 1 << 20;
+  const char *data;
+  size_t len, pos;
+  char *chunk;
+  void *mapped;
+  size_t mapped_len;
+  int fd;
+
+  // 读入下一块，返回 false 表示输入结束
+  bool refill() {
+    if (mapped)
+      return false;
+    ssize_t n;
+    do {
+      n = ::read(fd, chunk, CHUNK);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0)
+      return false;
+    data = chunk;
+    len = n;
+    pos = 0;
+    return true;
+  }
+
+public:
+  explicit FastInput(int fd_ = 0)
+      : data(nullptr), len(0), pos(0), chunk(nullptr), mapped(nullptr),
+        mapped_len(0), fd(fd_) {
+#if defined(__linux__)
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      off_t offset = lseek(fd, 0, SEEK_CUR);
+      if (offset < 0)
+        offset = 0;
+      void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+        mapped = p;
+        mapped_len = st.st_size;
+        data = static_cast<const char *>(p);
+        len = st.st_size;
+        pos = offset < st.st_size ? offset : st.st_size;
+        return;
+      }
+    }
+#endif
+    chunk = new char[CHUNK];
+  }
+
+  ~FastInput() {
+#if defined(__linux__)
+    if (mapped)
+      munmap(mapped, mapped_len);
+#endif
+    delete[] chunk;
+  }
+
+  FastInput(const FastInput &) = delete;
+  FastInput &operator=(const FastInput &) = delete;
+
+  // 下一个字节，输入结束时返回 -1
+  inline int get() {
+    if (pos == len && !refill())
+      return -1;
+    return static_cast<unsigned char>(data[pos++]);
+  }
+
+  // 输入以 s[0, n) 开头时跳过它并返回 true，否则不移动读取位置。
+  // 只检查已缓冲的数据，管道的第一块不足 n 字节时视为不匹配
+  bool consume(const char *s, size_t n) {
+    if (pos == len)
+      refill();
+    if (len - pos < n || std::memcmp(data + pos, s, n) != 0)
+      return false;
+    pos += n;
+    return true;
+  }
+
+  // 读一个十进制整数（可带负号），输入结束时返回 false
+  inline bool readInt(ll &x) {
+    int c = get();
+    while (c != -1 && (c < '0' || c > '9') && c != '-')
+      c = get();
+    if (c == -1)
+      return false;
+    bool neg = c == '-';
+    if (neg)
+      c = get();
+    ll v = 0;
+    while (c >= '0' && c <= '9') {
+      v = v * 10 + (c - '0');
+      c = get();
+    }
+    x = neg ? -v : v;
+    return true;
+  }
+};
+
+// 结果输出：写入可复用的大缓冲区，满了或析构时一次性写出
+class FastOutput {
+private:
+  static const size_t SIZE = 1 << 16;
+  char buf[SIZE];
+  size_t pos;
+  int fd;
+
+public:
+  explicit FastOutput(int fd_ = 1) : pos(0), fd(fd_) {}
+  ~FastOutput() { flush(); }
+
+  FastOutput(const FastOutput &) = delete;
+  FastOutput &operator=(const FastOutput &) = delete;
+
+  void flush() {
+    size_t done = 0;
+    while (done < pos) {
+      ssize_t n = ::write(fd, buf + done, pos - done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      done += n;
+    }
+    pos = 0;
+  }
+
+  inline void put(const char *s, size_t n) {
+    if (pos + n > SIZE)
+      flush();
+    std::memcpy(buf + pos, s, n);
+    pos += n;
+  }
+
+  inline void putChar(char ch) {
+    if (pos == SIZE)
+      flush();
+    buf[pos++] = ch;
+  }
+
+  inline void putLine(ll v) {
+    putInt(v);
+    putChar('\n');
+  }
+
+  // 输出十进制整数，每次处理两位数字
+  inline void putInt(ll v) {
+    static const char digits[] = "00010203040506070809"
+                                 "10111213141516171819"
+                                 "20212223242526272829"
+                                 "30313233343536373839"
+                                 "40414243444546474849"
+                                 "50515253545556575859"
+                                 "60616263646566676869"
+                                 "70717273747576777879"
+                                 "80818283848586878889"
+                                 "90919293949596979899";
+    char tmp[24];
+    char *end = tmp + sizeof(tmp), *p = end;
+    unsigned long long u = v < 0 ? 0ULL - v : v;
+    while (u >= 100) {
+      const char *d = digits + (u % 100) * 2;
+      u /= 100;
+      *--p = d[1];
+      *--p = d[0];
+    }
+    if (u >= 10) {
+      *--p = digits[u * 2 + 1];
+      *--p = digits[u * 2];
+    } else {
+      *--p = char('0' + u);
+    }
+    if (v < 0)
+      *--p = '-';
+    put(p, end - p);
+  }
+};
+
+// 版本表：按块存放 ESet，增长时只追加新块，已有版本既不移动也不被复制
+class VersionTable {
+private:
+  static const size_t CHUNK = 1024;
+  std::vector<std::unique_ptr<ESet[]>> chunks;
+  size_t count;
+
+public:
+  VersionTable() : count(0) {}
+
+  size_t size() const { return count; }
+
+  ESet &operator[](size_t i) { return chunks[i / CHUNK][i % CHUNK]; }
+
+  // 扩展到至少 n 个版本，新版本为空集合
+  void resize(size_t n) {
+    while (chunks.size() * CHUNK < n)
+      chunks.emplace_back(new ESet[CHUNK]);
+    if (n > count)
+      count = n;
+  }
+
+  void push_back(const ESet &s) {
+    resize(count + 1);
+    (*this)[count - 1] = s;
+  }
+};
+
+// 一条命令：操作码和最多三个参数
+struct Command {
+  int op;
+  ll a, b, c;
+};
+
+// 各操作码带的参数个数，未知操作码不带参数
+static int operandCount(int op) {
+  switch (op) {
+  case 0:
+  case 1:
+  case 3:
+  case 8:
+  case 9:
+    return 2;
+  case 2:
+  case 7:
+    return 1;
+  case 4:
+    return 3;
+  default:
+    return 0;
+  }
+}
+
+// 文本命令：空白分隔的十进制整数
+class TextCommandReader {
+private:
+  FastInput &in;
+
+public:
+  explicit TextCommandReader(FastInput &in_) : in(in_) {}
+
+  bool next(Command &cmd) {
+    ll op;
+    if (!in.readInt(op))
+      return false;
+    cmd.op = op;
+    cmd.a = cmd.b = cmd.c = 0;
+    ll *args[3] = {&cmd.a, &cmd.b, &cmd.c};
+    for (int i = 0; i < operandCount(cmd.op); ++i)
+      in.readInt(*args[i]);
+    return true;
+  }
+};
+
+static void writeText(FastOutput &out, const Command &cmd) {
+  out.putInt(cmd.op);
+  const ll args[3] = {cmd.a, cmd.b, cmd.c};
+  for (int i = 0; i < operandCount(cmd.op); ++i) {
+    out.putChar(' ');
+    out.putInt(args[i]);
+  }
+  out.putChar('\n');
+}
+
+// 二进制命令日志：文件头是 7 字节魔数 "ESETLOG" 加 1 字节格式版本号，
+// 之后每条命令是 1 字节操作码，再跟该操作的参数；每个参数先做 zigzag
+// 变换（0, -1, 1, -2 ... 映射为 0, 1, 2, 3 ...），再按 LEB128 编码，
+// 每字节 7 位、低位在前、最高位表示后面还有字节
+// 版本 2 增加了带一个参数的操作 7，版本 3、4 分别增加了带两个参数的
+// 操作 8、9，读取端仍接受旧版本的日志
+// 日志在命令中间截断时，已读到的命令照常执行，程序以状态 1 退出
+static const char LOG_MAGIC[7] = {'E', 'S', 'E', 'T', 'L', 'O', 'G'};
+static const int LOG_VERSION = 4;
+
+class BinaryCommandReader {
+private:
+  FastInput &in;
+  bool truncated;
+
+  bool readVarint(ll &x) {
+    unsigned long long u = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      int byte = in.get();
+      if (byte < 0)
+        return false;
+      u |= (unsigned long long)(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        x = (ll)(u >> 1) ^ -(ll)(u & 1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+public:
+  // 文件头已由调用方读过
+  explicit BinaryCommandReader(FastInput &in_) : in(in_), truncated(false) {}
+
+  // 日志是否在一条命令中间结束
+  bool failed() const { return truncated; }
+
+  bool next(Command &cmd) {
+    int op = in.get();
+    if (op < 0)
+      return false;
+    cmd.op = op;
+    cmd.a = cmd.b = cmd.c = 0;
+    ll *args[3] = {&cmd.a, &cmd.b, &cmd.c};
+    for (int i = 0; i < operandCount(cmd.op); ++i)
+      if (!readVarint(*args[i])) {
+        std::cerr << "truncated command log\n";
+        truncated = true;
+        return false;
+      }
+    return true;
+  }
+};
+
+static void writeBinaryHeader(FastOutput &out) {
+  out.put(LOG_MAGIC, sizeof(LOG_MAGIC));
+  out.putChar(char(LOG_VERSION));
+}
+
+static void writeBinary(FastOutput &out, const Command &cmd) {
+  out.putChar(char(cmd.op));
+  const ll args[3] = {cmd.a, cmd.b, cmd.c};
+  for (int i = 0; i < operandCount(cmd.op); ++i) {
+    unsigned long long u = ((unsigned long long)args[i] << 1) ^
+                           (unsigned long long)(args[i] >> 63);
+    while (u >= 0x80) {
+      out.putChar(char(u | 0x80));
+      u >>= 7;
+    }
+    out.putChar(char(u));
+  }
+}
+
+// 下标 v 是否是已有的版本，负数一律无效
+static bool validVersion(const VersionTable &sets, ll v) {
+  return v >= 0 && size_t(v) < sets.size();
+}
+
+// 一行空格分隔的关键字
+static void putKeys(FastOutput &out, const std::vector<ll> &keys) {
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (i)
+      out.putChar(' ');
+    out.putInt(keys[i]);
+  }
+  out.putChar('\n');
+}
+
 // This program implements a persistent set using treap with copy-on-write
 // semantics. Supported operations (via standard input):
 // 0 a b — emplace value b into set s[a]
@@ -350,21 +1338,34 @@ public:
 // 4 a b c — count elements in set s[a] within range [b, c]
 // 5     — if valid iterator, move it backward and print value, else print -1
 // 6     — if valid iterator, move it forward and print value, else print -1
-int main() {
-
-  std::ios::sync_with_stdio(false);
-  std::cin.tie(nullptr);
-  std::vector<ESet> sets(1);
-  int op, lst = 0, it_a = -1;
+// 7 a   — drop set s[a]: it becomes empty and nodes no other set uses are freed
+// 8 a b — check if sets s[a] and s[b] hold the same elements
+// 9 a b — print the values in s[a] but not in s[b] on one line, then the
+//         values in s[b] but not in s[a] on the next, both ascending
+// Built with ESET_PARALLEL=1 (and -pthread), commands are replayed in batches
+// split by version across ESET_THREADS threads; output order is unchanged.
+// check/parallel.sh compares that build against the sequential one on
+// random command streams.
+// Input is either the text protocol above or a binary command log (see
+// LOG_MAGIC), told apart by the log's header. Command-line modes:
+//   (none)        replay the commands and print the results
+//   --to-binary   convert the commands to a binary log on stdout
+//   --to-text     convert the commands to the text protocol on stdout
+template <class Reader> void replay(Reader &reader, FastOutput &out) {
+  VersionTable sets;
+  sets.resize(1);
+  std::vector<ll> removed, added;
+  int op, it_a = -1;
   ll it_b = -1;
   bool valid = false;
 
-  while (std::cin >> op) {
-    ll a, b, c;
+  Command cmd;
+  while (reader.next(cmd)) {
+    op = cmd.op;
+    ll a = cmd.a, b = cmd.b, c = cmd.c;
     switch (op) {
     case 0:
       // 插入元素 b 到集合 s[a]
-      std::cin >> a >> b;
       if (a >= sets.size())
         sets.resize(a + 1);
       if (sets[a].emplace(b)) {
@@ -375,32 +1376,28 @@ int main() {
       break;
     case 1:
       // 从集合 s[a] 删除元素 b
-      std::cin >> a >> b;
       if (valid && it_a == a && it_b == b)
         valid = false;
       sets[a].erase(b);
       break;
     case 2:
       // 复制集合 s[a] 到新的集合 s.back()
-      std::cin >> a;
       sets.push_back(sets[a]);
       break;
     case 3:
       // 查询集合 s[a] 是否包含元素 b
-      std::cin >> a >> b;
-      if (a < sets.size() && sets[a].contains(b)) {
-        std::cout << "true\n";
+      if (validVersion(sets, a) && sets[a].contains(b)) {
+        out.put("true\n", 5);
         it_a = a;
         it_b = b;
         valid = true;
       } else {
-        std::cout << "false\n";
+        out.put("false\n", 6);
       }
       break;
     case 4:
       // 查询集合 s[a] 中区间 [b, c] 内的元素数量
-      std::cin >> a >> b >> c;
-      std::cout << sets[a].range(b, c) << '\n';
+      out.putLine(sets[a].range(b, c));
 
       break;
     case 5:
@@ -409,13 +1406,13 @@ int main() {
         ll pred = sets[it_a].predecessor(it_b);
         if (pred != -1 && pred < it_b) {
           it_b = pred;
-          std::cout << it_b << '\n';
+          out.putLine(it_b);
         } else {
           valid = false;
-          std::cout << "-1\n";
+          out.put("-1\n", 3);
         }
       } else {
-        std::cout << "-1\n";
+        out.put("-1\n", 3);
       }
       break;
     case 6:
@@ -424,16 +1421,437 @@ int main() {
         ll succ = sets[it_a].successor(it_b);
         if (succ != -1 && succ > it_b) {
           it_b = succ;
-          std::cout << it_b << '\n';
+          out.putLine(it_b);
         } else {
           valid = false;
-          std::cout << "-1\n";
+          out.put("-1\n", 3);
         }
       } else {
-        std::cout << "-1\n";
+        out.put("-1\n", 3);
+      }
+      break;
+    case 7:
+      // 丢弃版本 s[a]，下标保留为空集合
+      if (validVersion(sets, a)) {
+        if (valid && it_a == a)
+          valid = false;
+        sets[a].clear();
       }
       break;
+    case 8:
+      // 比较集合 s[a] 与 s[b] 的内容是否相同
+      if (validVersion(sets, a) && validVersion(sets, b) &&
+          sets[a].equals(sets[b]))
+        out.put("true\n", 5);
+      else
+        out.put("false\n", 6);
+      break;
+    case 9:
+      // 输出集合 s[a] 到 s[b] 删掉和新增的元素
+      removed.clear();
+      added.clear();
+      if (validVersion(sets, a) && validVersion(sets, b))
+        sets[a].diff(sets[b], removed, added);
+      putKeys(out, removed);
+      putKeys(out, added);
+      break;
+    }
+  }
+}
+
+#if ESET_PARALLEL
+// 工作线程池：run(n, task) 让所有线程（含调用线程）领取 task(0..n-1)，
+// 全部完成后返回；两次 run 之间工作线程睡在条件变量上
+class WorkerPool {
+private:
+  std::vector<std::thread> workers;
+  std::mutex lock;
+  std::condition_variable wake, done;
+  std::function<void(size_t)> task;
+  size_t task_count;
+  std::atomic<size_t> next_task;
+  size_t busy;             // 本轮还没做完的工作线程数
+  unsigned long generation; // 每次 run 加一，唤醒工作线程
+  bool stopping;
+
+  void drain() {
+    for (size_t i; (i = next_task.fetch_add(1)) < task_count;)
+      task(i);
+  }
+
+  void loop() {
+    unsigned long seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [&] { return stopping || generation != seen; });
+        if (stopping)
+          return;
+        seen = generation;
+      }
+      drain();
+      std::lock_guard<std::mutex> guard(lock);
+      if (--busy == 0)
+        done.notify_one();
+    }
+  }
+
+public:
+  explicit WorkerPool(size_t threads)
+      : task_count(0), next_task(0), busy(0), generation(0), stopping(false) {
+    for (size_t i = 1; i < threads; ++i)
+      workers.emplace_back(&WorkerPool::loop, this);
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : workers)
+      t.join();
+  }
+
+  size_t threads() const { return workers.size() + 1; }
+
+  void run(size_t n, std::function<void(size_t)> f) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      task = std::move(f);
+      task_count = n;
+      next_task = 0;
+      busy = workers.size();
+      ++generation;
+    }
+    wake.notify_all();
+    drain();
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [&] { return busy == 0; });
+  }
+};
+
+// 操作 9 的结果，执行时写入调度方预留的位置
+struct Diff {
+  std::vector<ll> removed, added;
+};
+
+// 执行一条只涉及版本 a 的命令（操作 2 的目标版本已由调度方放在 b 中，
+// 操作 9 的结果位置放在 c 中），返回插入/查询是否成功或区间计数，
+// 迭代器和输出留给调度方按原顺序处理
+static ll applyCommand(VersionTable &sets, std::vector<Diff> &diffs,
+                       const Command &cmd) {
+  switch (cmd.op) {
+  case 0:
+    return sets[cmd.a].emplace(cmd.b);
+  case 1:
+    sets[cmd.a].erase(cmd.b);
+    return 0;
+  case 2:
+    sets[cmd.b] = sets[cmd.a];
+    return 0;
+  case 3:
+    return sets[cmd.a].contains(cmd.b);
+  case 4:
+    return sets[cmd.a].range(cmd.b, cmd.c);
+  case 7:
+    sets[cmd.a].clear();
+    return 1;
+  case 8:
+    return sets[cmd.a].equals(sets[cmd.b]);
+  case 9:
+    sets[cmd.a].diff(sets[cmd.b], diffs[cmd.c].removed, diffs[cmd.c].added);
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+// 并行回放：预读一批命令，按版本分组后交给线程池执行，再按原顺序
+// 更新迭代器并输出结果。
+// - 同一版本的命令在同一组内按原顺序执行；操作 2 复制出的新版本并入
+//   源版本所在的组，操作 8/9 比较的两个版本的组合并成一组，所以组与组
+//   之间只共享不会被原地修改的节点
+// - 操作 5/6 要读迭代器所在的版本，遇到时结束本批，等全部组执行完后
+//   在调度线程上执行
+// - 版本表只在调度线程上扩展，执行期间不移动
+template <class Reader>
+void replayParallel(Reader &reader, FastOutput &out, WorkerPool &pool) {
+  static const size_t BATCH = 1 << 16;
+  static const size_t MIN_PARALLEL = 1 << 10; // 更小的批直接在本线程执行
+  static const uint32_t NO_GROUP = ~0u;
+
+  VersionTable sets;
+  sets.resize(1);
+  ll it_a = -1, it_b = -1;
+  bool valid = false;
+
+  std::vector<Command> batch;
+  std::vector<ll> result;
+  std::vector<Diff> diffs;                // 本批操作 9 的结果
+  std::vector<uint32_t> group_of;         // 每条命令所属的组
+  std::vector<uint64_t> version_epoch;    // 版本在哪一批里分配过组
+  std::vector<uint32_t> version_group;    // 版本在本批中所属的组
+  std::vector<uint32_t> parent;           // 组的并查集
+  std::vector<uint32_t> dense;            // 并查集的根到连续组号
+  std::vector<uint32_t> group_begin, cursor, order, tasks;
+  uint64_t epoch = 0;
+  uint32_t groups = 0;
+
+  auto find = [&](uint32_t g) {
+    while (parent[g] != g)
+      g = parent[g] = parent[parent[g]];
+    return g;
+  };
+  auto groupOf = [&](size_t v) {
+    if (version_epoch.size() < sets.size()) {
+      version_epoch.resize(sets.size(), 0);
+      version_group.resize(sets.size());
+    }
+    if (version_epoch[v] != epoch) {
+      version_epoch[v] = epoch;
+      version_group[v] = groups;
+      parent.push_back(groups++);
+    }
+    return find(version_group[v]);
+  };
+
+  bool more = true;
+  while (more) {
+    ++epoch;
+    groups = 0;
+    parent.clear();
+    batch.clear();
+    size_t diff_count = 0;
+    group_of.clear();
+
+    // 预读并分组；越界检查用的 sets.size() 与顺序执行到这里时一致
+    Command cmd;
+    while (batch.size() < BATCH && (more = reader.next(cmd))) {
+      uint32_t g = NO_GROUP;
+      size_t a = cmd.a;
+      switch (cmd.op) {
+      case 0:
+        if (a >= sets.size())
+          sets.resize(a + 1);
+        g = groupOf(a);
+        break;
+      case 1:
+      case 3:
+      case 4:
+      case 7:
+        if (a < sets.size())
+          g = groupOf(a);
+        break;
+      case 2: {
+        size_t copy = sets.size();
+        sets.resize(copy + 1);
+        if (a < copy) {
+          g = groupOf(a);
+          version_epoch[copy] = epoch;
+          version_group[copy] = g;
+          cmd.b = copy;
+        }
+        break;
+      }
+      case 8:
+      case 9:
+        if (a < sets.size() && size_t(cmd.b) < sets.size()) {
+          g = groupOf(a);
+          uint32_t h = groupOf(cmd.b);
+          if (g != h)
+            parent[h] = g;
+        }
+        if (cmd.op == 9)
+          cmd.c = diff_count++;
+        break;
+      }
+      batch.push_back(cmd);
+      group_of.push_back(g);
+      if (cmd.op == 5 || cmd.op == 6)
+        break;
+    }
+
+    size_t n = batch.size();
+    result.assign(n, 0);
+    if (diffs.size() < diff_count)
+      diffs.resize(diff_count);
+    for (size_t i = 0; i < diff_count; ++i) {
+      diffs[i].removed.clear();
+      diffs[i].added.clear();
     }
+
+    // 被合并的组换成并查集的根，再把根编成连续的号
+    uint32_t roots = 0;
+    dense.resize(groups);
+    for (uint32_t g = 0; g < groups; ++g)
+      if (parent[g] == g)
+        dense[g] = roots++;
+    for (size_t i = 0; i < n; ++i)
+      if (group_of[i] != NO_GROUP)
+        group_of[i] = dense[find(group_of[i])];
+    groups = roots;
+
+    if (groups > 1 && n >= MIN_PARALLEL && pool.threads() > 1) {
+      // 按组做计数排序，大组先发出去
+      group_begin.assign(groups + 1, 0);
+      for (size_t i = 0; i < n; ++i)
+        if (group_of[i] != NO_GROUP)
+          ++group_begin[group_of[i] + 1];
+      for (uint32_t g = 0; g < groups; ++g)
+        group_begin[g + 1] += group_begin[g];
+      order.resize(group_begin[groups]);
+      cursor.assign(group_begin.begin(), group_begin.end() - 1);
+      for (size_t i = 0; i < n; ++i)
+        if (group_of[i] != NO_GROUP)
+          order[cursor[group_of[i]]++] = i;
+      tasks.resize(groups);
+      for (uint32_t g = 0; g < groups; ++g)
+        tasks[g] = g;
+      std::sort(tasks.begin(), tasks.end(), [&](uint32_t x, uint32_t y) {
+        return group_begin[x + 1] - group_begin[x] >
+               group_begin[y + 1] - group_begin[y];
+      });
+      pool.run(groups, [&](size_t t) {
+        uint32_t g = tasks[t];
+        for (uint32_t k = group_begin[g]; k < group_begin[g + 1]; ++k)
+          result[order[k]] = applyCommand(sets, diffs, batch[order[k]]);
+      });
+    } else {
+      for (size_t i = 0; i < n; ++i)
+        if (group_of[i] != NO_GROUP)
+          result[i] = applyCommand(sets, diffs, batch[i]);
+    }
+
+    // 按原顺序更新迭代器并输出
+    for (size_t i = 0; i < n; ++i) {
+      const Command &c = batch[i];
+      switch (c.op) {
+      case 0:
+        if (result[i]) {
+          it_a = c.a;
+          it_b = c.b;
+          valid = true;
+        }
+        break;
+      case 1:
+        if (valid && it_a == c.a && it_b == c.b)
+          valid = false;
+        break;
+      case 3:
+        if (result[i]) {
+          out.put("true\n", 5);
+          it_a = c.a;
+          it_b = c.b;
+          valid = true;
+        } else {
+          out.put("false\n", 6);
+        }
+        break;
+      case 4:
+        out.putLine(result[i]);
+        break;
+      case 5:
+      case 6: {
+        ll next = -1;
+        if (valid) {
+          next = c.op == 5 ? sets[it_a].predecessor(it_b)
+                           : sets[it_a].successor(it_b);
+          if (next != -1 && (c.op == 5 ? next < it_b : next > it_b))
+            it_b = next;
+          else
+            valid = false;
+        }
+        if (valid)
+          out.putLine(it_b);
+        else
+          out.put("-1\n", 3);
+        break;
+      }
+      case 7:
+        if (result[i] && valid && it_a == c.a)
+          valid = false;
+        break;
+      case 8:
+        if (result[i])
+          out.put("true\n", 5);
+        else
+          out.put("false\n", 6);
+        break;
+      case 9:
+        putKeys(out, diffs[c.c].removed);
+        putKeys(out, diffs[c.c].added);
+        break;
+      }
+    }
+  }
+}
+#endif
+
+template <class Reader> void convert(Reader &reader, FastOutput &out,
+                                     bool binary) {
+  if (binary)
+    writeBinaryHeader(out);
+  Command cmd;
+  while (reader.next(cmd)) {
+    if (binary)
+      writeBinary(out, cmd);
+    else
+      writeText(out, cmd);
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *mode = argc > 1 ? argv[1] : "";
+  bool to_binary = std::strcmp(mode, "--to-binary") == 0;
+  bool to_text = std::strcmp(mode, "--to-text") == 0;
+  if (*mode && !to_binary && !to_text) {
+    std::cerr << "usage: " << argv[0] << " [--to-binary | --to-text]\n";
+    return 2;
+  }
+
+  FastInput in;
+  FastOutput out;
+  bool binary_input = in.consume(LOG_MAGIC, sizeof(LOG_MAGIC));
+  if (binary_input) {
+    int version = in.get();
+    if (version < 1 || version > LOG_VERSION) {
+      std::cerr << "unsupported command log version " << version << '\n';
+      return 1;
+    }
+  }
+  TextCommandReader text_reader(in);
+  BinaryCommandReader binary_reader(in);
+
+  if (to_binary || to_text) {
+    if (binary_input)
+      convert(binary_reader, out, to_binary);
+    else
+      convert(text_reader, out, to_binary);
+    return binary_reader.failed() ? 1 : 0;
+  }
+
+#if ESET_PARALLEL
+  const char *env = std::getenv("ESET_THREADS");
+  size_t threads = env ? std::strtoul(env, nullptr, 10)
+                       : std::thread::hardware_concurrency();
+  if (threads > 1) {
+    WorkerPool pool(threads);
+    if (binary_input)
+      replayParallel(binary_reader, out, pool);
+    else
+      replayParallel(text_reader, out, pool);
+  } else
+#endif
+  if (binary_input)
+    replay(binary_reader, out);
+  else
+    replay(text_reader, out);
+  if (std::getenv("ESET_POOL_STATS")) {
+    NodePool::Stats st = global_node_pool.stats();
+    std::cerr << "pool: live " << st.live_bytes << " B, peak live "
+              << st.peak_live_bytes << " B, os " << st.os_bytes
+              << " B, peak os " << st.peak_os_bytes << " B\n";
   }
-  return 0;
-}
\ No newline at end of file
+  return binary_reader.failed() ? 1 : 0;
+}
@@ -1,19 +1,33 @@
 #ifndef SJTU_ESET_HPP
 #define SJTU_ESET_HPP
 
+#ifdef SJTU_ESET_PERSISTENT_HPP
+#error "Eset.hpp and Eset_persistent.hpp both define ESet; include only one"
+#endif
+
+#include "Eset_common.hpp"
+#include "Eset_frozen.hpp"
+#include "Eset_parallel.hpp"
+#include "Eset_pool.hpp"
 #include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <span>
 #include <stdexcept>
+#include <tuple>
+#include <type_traits>
 #include <utility>
+#include <vector>
 // Task 1
 //  ESet: A balanced ordered set container implemented using a red-black tree.
 //  Supports insertion, deletion, search, and range queries with logarithmic
 //  complexity.
 
-template <typename T> struct DefaultLess {
-  bool operator()(const T &a, const T &b) const { return a < b; }
-};
-
-template <class Key, class Compare = DefaultLess<Key>> class ESet {
+// Alloc is rebound to the node type; ESetPool<Key, true> puts the nodes on
+// huge pages, std::allocator<Key> restores plain new/delete.
+template <class Key, class Compare = DefaultLess<Key>,
+          class Alloc = ESetPool<Key>>
+class ESet {
 private:
   enum Color { RED, BLACK };
 
@@ -24,61 +38,92 @@ public:
     Node *parent;
     Node *left;
     Node *right;
+    size_t size; // number of nodes in the subtree rooted here
     Color color;
 
     Node(const Key &k, Node *p = nullptr, Node *l = nullptr, Node *r = nullptr,
          Color c = RED)
-        : key(k), parent(p), left(l), right(r), color(c) {}
+        : key(k), parent(p), left(l), right(r), size(1), color(c) {}
+
+    // Build the key in place from args
+    template <class... Args>
+    Node(std::in_place_t, Node *p, Color c, Args &&...args)
+        : key(std::forward<Args>(args)...), parent(p), left(nullptr),
+          right(nullptr), size(1), color(c) {}
   };
 
 private:
   // Red-Black Tree implementation
   class RBTree {
-    friend class ESet<Key, Compare>;
+    friend class ESet;
+
+    using NodeAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+    using NodeTraits = std::allocator_traits<NodeAlloc>;
+    static_assert(NodeTraits::propagate_on_container_move_assignment::value ||
+                      NodeTraits::is_always_equal::value,
+                  "ESet moves nodes between trees together with the allocator");
 
   private:
     Node *root;
     size_t node_count;
     Compare comp;
+    NodeAlloc alloc;
+
+    // Subtree size of x, treating nullptr as an empty subtree
+    __attribute__((always_inline)) static inline size_t sizeOf(Node *x) {
+      return x ? x->size : 0;
+    }
 
   protected:
-    // Left rotate around node x
-    void leftRotate(Node *x) {
+    // Left rotate around node x inside the tree rooted at top
+    static void leftRotate(Node *x, Node *&top) {
       Node *y = x->right;
       x->right = y->left;
       if (y->left)
         y->left->parent = x;
       y->parent = x->parent;
       if (!x->parent)
-        root = y;
+        top = y;
       else if (x == x->parent->left)
         x->parent->left = y;
       else
         x->parent->right = y;
       y->left = x;
       x->parent = y;
+      y->size = x->size;
+      x->size = 1 + sizeOf(x->left) + sizeOf(x->right);
     }
 
-    // Right rotate around node x
-    void rightRotate(Node *x) {
+    // Right rotate around node x inside the tree rooted at top
+    static void rightRotate(Node *x, Node *&top) {
       Node *y = x->left;
       x->left = y->right;
       if (y->right)
         y->right->parent = x;
       y->parent = x->parent;
       if (!x->parent)
-        root = y;
+        top = y;
       else if (x == x->parent->right)
         x->parent->right = y;
       else
         x->parent->left = y;
       y->right = x;
       x->parent = y;
+      y->size = x->size;
+      x->size = 1 + sizeOf(x->left) + sizeOf(x->right);
     }
 
+    // Left rotate around node x
+    void leftRotate(Node *x) { leftRotate(x, root); }
+
+    // Right rotate around node x
+    void rightRotate(Node *x) { rightRotate(x, root); }
+
   private:
-    // Fix red-black tree properties after insertion of node z
-    void insertFixup(Node *z) {
+    // Fix red-black tree properties after insertion of node z into the tree
+    // rooted at top. Returns true if the black height of that tree grew.
+    static bool insertFixup(Node *z, Node *&top) {
       while (z->parent && z->parent->color == RED) {
         if (z->parent == z->parent->parent->left) {
           Node *y = z->parent->parent->right;
@@ -92,12 +137,12 @@ private:
             // Case 2: Uncle y is black and z is right child, rotate left
             if (z == z->parent->right) {
               z = z->parent;
-              leftRotate(z);
+              leftRotate(z, top);
             }
             // Case 3: Uncle y is black and z is left child, rotate right
             z->parent->color = BLACK;
             z->parent->parent->color = RED;
-            rightRotate(z->parent->parent);
+            rightRotate(z->parent->parent, top);
           }
         } else {
           Node *y = z->parent->parent->left;
@@ -110,17 +155,23 @@ private:
           } else {
             if (z == z->parent->left) {
               z = z->parent;
-              rightRotate(z);
+              rightRotate(z, top);
             }
             z->parent->color = BLACK;
             z->parent->parent->color = RED;
-            leftRotate(z->parent->parent);
+            leftRotate(z->parent->parent, top);
           }
         }
       }
-      root->color = BLACK;
+      // Only case 1 can leave the top red; blackening it adds a black level
+      bool grew = top->color == RED;
+      top->color = BLACK;
+      return grew;
     }
 
+    // Fix red-black tree properties after insertion of node z
+    void insertFixup(Node *z) { insertFixup(z, root); }
+
     // Fix red-black tree properties after deletion of a node
     void eraseFixup(Node *x, Node *x_parent) {
       while (x != root && (!x || x->color == BLACK)) {
@@ -199,30 +250,370 @@ private:
         x->color = BLACK;
     }
 
+    // Allocate and construct a detached node through the allocator, with
+    // the key built in place from args
+    template <class... Args>
+    Node *createNode(Node *p, Color c, Args &&...args) {
+      Node *x = NodeTraits::allocate(alloc, 1);
+      try {
+        NodeTraits::construct(alloc, x, std::in_place, p, c,
+                              std::forward<Args>(args)...);
+      } catch (...) {
+        NodeTraits::deallocate(alloc, x, 1);
+        throw;
+      }
+      return x;
+    }
+
+    void destroyNode(Node *x) {
+      NodeTraits::destroy(alloc, x);
+      NodeTraits::deallocate(alloc, x, 1);
+    }
+
     // Deep copy of the tree starting from node x, with parent p
     Node *copyTree(Node *x, Node *p) {
       if (!x)
         return nullptr;
-      Node *new_node = new Node(x->key, p, nullptr, nullptr, x->color);
+      Node *new_node = createNode(p, x->color, x->key);
+      new_node->size = x->size;
       new_node->left = copyTree(x->left, new_node);
       new_node->right = copyTree(x->right, new_node);
       return new_node;
     }
 
+    // Copy the subtree x into the preallocated slots, which are laid out in
+    // pre-order: x goes to slots[idx], its left subtree right after it and
+    // its right subtree after that, so disjoint subtrees can be copied by
+    // different threads without coordination.
+    void copyInto(Node *x, Node *p, Node *const *slots, size_t idx,
+                  size_t depth) {
+      Node *y = slots[idx];
+      NodeTraits::construct(alloc, y, x->key, p, nullptr, nullptr, x->color);
+      y->size = x->size;
+      if (x->left)
+        y->left = slots[idx + 1];
+      if (x->right)
+        y->right = slots[idx + 1 + sizeOf(x->left)];
+      auto copy_left = [&] {
+        if (x->left)
+          copyInto(x->left, y, slots, idx + 1, depth ? depth - 1 : 0);
+      };
+      auto copy_right = [&] {
+        if (x->right)
+          copyInto(x->right, y, slots, idx + 1 + sizeOf(x->left),
+                   depth ? depth - 1 : 0);
+      };
+      if (x->size >= PARALLEL_GRAIN)
+        parallelInvoke(copy_left, copy_right, depth);
+      else {
+        copy_left();
+        copy_right();
+      }
+    }
+
+    // Deep copy of other's nodes into this (empty) tree. Large trees get
+    // all their nodes up front in one contiguous pre-order run and are then
+    // filled in on the work-stealing pool.
+    void copyFrom(const RBTree &other) {
+      if (other.node_count < PARALLEL_GRAIN ||
+          !std::is_nothrow_copy_constructible_v<Key>) {
+        root = copyTree(other.root, nullptr);
+        return;
+      }
+      if constexpr (requires(NodeAlloc &a) { a.reserve(size_t(0)); })
+        alloc.reserve(other.node_count);
+      std::vector<Node *> slots;
+      slots.reserve(other.node_count);
+      try {
+        for (size_t i = 0; i < other.node_count; ++i)
+          slots.push_back(NodeTraits::allocate(alloc, 1));
+      } catch (...) {
+        for (Node *x : slots)
+          NodeTraits::deallocate(alloc, x, 1);
+        throw;
+      }
+      copyInto(other.root, nullptr, slots.data(), 0, parallelDepth());
+      root = slots[0];
+    }
+
+    // Build a perfectly balanced subtree from the sorted keys a[0, n) into
+    // slot. Nodes on level red_depth (the deepest, possibly partial level)
+    // are red, everything above is black, so every path has the same number
+    // of black nodes. Nodes are linked as soon as they are created so a
+    // throwing key copy leaves a tree that clear() can still free.
+    void buildTree(Node *&slot, Node *p, const Key *a, size_t n, size_t depth,
+                   size_t red_depth) {
+      if (!n) {
+        slot = nullptr;
+        return;
+      }
+      size_t mid = n / 2;
+      Node *x = createNode(p, depth == red_depth && depth > 0 ? RED : BLACK,
+                           a[mid]);
+      slot = x;
+      x->size = n;
+      buildTree(x->left, x, a, mid, depth + 1, red_depth);
+      buildTree(x->right, x, a + mid + 1, n - mid - 1, depth + 1, red_depth);
+    }
+
+    // A detached subtree with its black height (black nodes on any path
+    // from the root down, root included). Roots are always kept black.
+    struct Sub {
+      Node *root;
+      size_t bh;
+    };
+
+    // Nodes dropped by the set operations, each entry a subtree root
+    using Garbage = std::vector<Node *>;
+
+    static size_t blackHeight(Node *x) {
+      size_t h = 0;
+      for (; x; x = x->left)
+        if (x->color == BLACK)
+          ++h;
+      return h;
+    }
+
+    // Cut c, whose black height counting itself is h, off its parent and
+    // make it a valid red-black tree on its own
+    static Sub detach(Node *c, size_t h) {
+      if (!c)
+        return {nullptr, 0};
+      c->parent = nullptr;
+      if (c->color == RED) {
+        c->color = BLACK;
+        ++h;
+      }
+      return {c, h};
+    }
+
+    // Split the non-empty t into its two subtrees, leaving its root unlinked
+    static std::pair<Sub, Sub> expose(Sub t) {
+      Node *x = t.root;
+      Sub l = detach(x->left, t.bh - 1);
+      Sub r = detach(x->right, t.bh - 1);
+      x->left = x->right = nullptr;
+      return {l, r};
+    }
+
+    // Join l, k and r, where every key of l < k < every key of r. k is hung
+    // off the inner spine of the taller tree at the first black node of
+    // matching black height, then insertFixup repairs a red-red edge.
+    static Sub join(Sub l, Node *k, Sub r) {
+      k->parent = nullptr;
+      if (l.bh == r.bh) {
+        k->left = l.root;
+        k->right = r.root;
+        if (l.root)
+          l.root->parent = k;
+        if (r.root)
+          r.root->parent = k;
+        k->color = BLACK;
+        k->size = 1 + sizeOf(l.root) + sizeOf(r.root);
+        return {k, l.bh + 1};
+      }
+      bool right_spine = l.bh > r.bh;
+      Sub tall = right_spine ? l : r;
+      Sub low = right_spine ? r : l;
+      size_t extra = 1 + sizeOf(low.root);
+      Node *p = nullptr;
+      Node *c = tall.root;
+      size_t h = tall.bh;
+      while (c && !(c->color == BLACK && h == low.bh)) {
+        c->size += extra;
+        if (c->color == BLACK)
+          --h;
+        p = c;
+        c = right_spine ? c->right : c->left;
+      }
+      k->color = RED;
+      k->parent = p;
+      if (c)
+        c->parent = k;
+      if (low.root)
+        low.root->parent = k;
+      if (right_spine) {
+        k->left = c;
+        k->right = low.root;
+        p->right = k;
+      } else {
+        k->left = low.root;
+        k->right = c;
+        p->left = k;
+      }
+      k->size = 1 + sizeOf(k->left) + sizeOf(k->right);
+      Node *top = tall.root;
+      bool grew = insertFixup(k, top);
+      return {top, tall.bh + (grew ? 1 : 0)};
+    }
+
+    // Split t into the keys less than key, the node equal to key (or
+    // nullptr) and the keys greater than key
+    std::tuple<Sub, Node *, Sub> split(Sub t, const Key &key) const {
+      if (!t.root)
+        return {Sub{nullptr, 0}, nullptr, Sub{nullptr, 0}};
+      Node *x = t.root;
+      Sub l, r, rest_l, rest_r;
+      Node *mid;
+      std::tie(l, r) = expose(t);
+      if (comp(key, x->key)) {
+        std::tie(rest_l, mid, rest_r) = split(l, key);
+        return {rest_l, mid, join(rest_r, x, r)};
+      }
+      if (comp(x->key, key)) {
+        std::tie(rest_l, mid, rest_r) = split(r, key);
+        return {join(l, x, rest_l), mid, rest_r};
+      }
+      return {l, x, r};
+    }
+
+    // Remove the largest node of the non-empty t, returning the rest and it
+    static std::pair<Sub, Node *> splitLast(Sub t) {
+      Node *x = t.root;
+      Sub l, r;
+      std::tie(l, r) = expose(t);
+      if (!r.root)
+        return {l, x};
+      auto [rest, last] = splitLast(r);
+      return {join(l, x, rest), last};
+    }
+
+    // Concatenate l and r, where every key of l < every key of r
+    static Sub join2(Sub l, Sub r) {
+      if (!l.root)
+        return r;
+      auto [rest, last] = splitLast(l);
+      return join(rest, last, r);
+    }
+
+    // Run both halves of a set operation, on the pool when there is enough
+    // work. The second half collects garbage separately so the two never
+    // touch the same vector.
+    template <class F, class G>
+    static void fork(size_t work, size_t depth, Garbage &garbage, F &&f,
+                     G &&g) {
+      if (depth == 0 || work < PARALLEL_GRAIN) {
+        f(garbage);
+        g(garbage);
+        return;
+      }
+      Garbage other;
+      parallelInvoke([&] { f(garbage); }, [&] { g(other); }, depth);
+      garbage.insert(garbage.end(), other.begin(), other.end());
+    }
+
+  public:
+    // Union of a and b; nodes of b equal to a key of a are dropped
+    Sub unite(Sub a, Sub b, Garbage &garbage, size_t depth) const {
+      if (!a.root)
+        return b;
+      if (!b.root)
+        return a;
+      size_t work = a.root->size + b.root->size;
+      Node *x = a.root;
+      Sub al, ar, bl, br, l, r;
+      Node *m;
+      std::tie(al, ar) = expose(a);
+      std::tie(bl, m, br) = split(b, x->key);
+      if (m)
+        garbage.push_back(m);
+      size_t next = depth ? depth - 1 : 0;
+      fork(
+          work, depth, garbage,
+          [&](Garbage &g) { l = unite(al, bl, g, next); },
+          [&](Garbage &g) { r = unite(ar, br, g, next); });
+      return join(l, x, r);
+    }
+
+    // Keys present in both a and b; the copy from a is kept
+    Sub intersect(Sub a, Sub b, Garbage &garbage, size_t depth) const {
+      if (!a.root || !b.root) {
+        if (a.root)
+          garbage.push_back(a.root);
+        if (b.root)
+          garbage.push_back(b.root);
+        return {nullptr, 0};
+      }
+      size_t work = a.root->size + b.root->size;
+      Node *x = a.root;
+      Sub al, ar, bl, br, l, r;
+      Node *m;
+      std::tie(al, ar) = expose(a);
+      std::tie(bl, m, br) = split(b, x->key);
+      size_t next = depth ? depth - 1 : 0;
+      fork(
+          work, depth, garbage,
+          [&](Garbage &g) { l = intersect(al, bl, g, next); },
+          [&](Garbage &g) { r = intersect(ar, br, g, next); });
+      if (m) {
+        garbage.push_back(m);
+        return join(l, x, r);
+      }
+      garbage.push_back(x);
+      return join2(l, r);
+    }
+
+    // Keys of a that are not in b
+    Sub subtract(Sub a, Sub b, Garbage &garbage, size_t depth) const {
+      if (!a.root || !b.root) {
+        if (b.root)
+          garbage.push_back(b.root);
+        return a;
+      }
+      size_t work = a.root->size + b.root->size;
+      Node *y = b.root;
+      Sub al, ar, bl, br, l, r;
+      Node *m;
+      std::tie(bl, br) = expose(b);
+      std::tie(al, m, ar) = split(a, y->key);
+      garbage.push_back(y);
+      if (m)
+        garbage.push_back(m);
+      size_t next = depth ? depth - 1 : 0;
+      fork(
+          work, depth, garbage,
+          [&](Garbage &g) { l = subtract(al, bl, g, next); },
+          [&](Garbage &g) { r = subtract(ar, br, g, next); });
+      return join2(l, r);
+    }
+
+    // Replace this tree with op(this, other), consuming other. Surviving
+    // nodes of other change owner, so its allocator is merged into ours.
+    void combine(RBTree &other,
+                 Sub (RBTree::*op)(Sub, Sub, Garbage &, size_t) const) {
+      if constexpr (requires(NodeAlloc &a) { a.absorb(a); })
+        alloc.absorb(other.alloc);
+      else
+        static_assert(NodeTraits::is_always_equal::value,
+                      "set algebra moves nodes between allocators");
+      Garbage garbage;
+      Sub res = (this->*op)(Sub{root, blackHeight(root)},
+                            Sub{other.root, blackHeight(other.root)}, garbage,
+                            parallelDepth());
+      root = res.root;
+      node_count = sizeOf(root);
+      other.root = nullptr;
+      other.node_count = 0;
+      for (Node *x : garbage)
+        clear(x);
+    }
+
   public:
-    RBTree() : root(nullptr), node_count(0), comp(Compare()) {}
-    ~RBTree() { clear(root); }
+    RBTree() : root(nullptr), node_count(0), comp(Compare()), alloc() {}
+    ~RBTree() { clearAll(); }
 
     RBTree(const RBTree &other)
-        : root(nullptr), node_count(0), comp(other.comp) {
-      root = copyTree(other.root, nullptr);
+        : root(nullptr), node_count(0), comp(other.comp),
+          alloc(NodeTraits::select_on_container_copy_construction(
+              other.alloc)) {
+      copyFrom(other);
       node_count = other.node_count;
     }
 
     RBTree &operator=(const RBTree &other) {
       if (this != &other) {
-        clear(root);
-        root = copyTree(other.root, nullptr);
+        clearAll();
+        copyFrom(other);
         node_count = other.node_count;
         comp = other.comp;
       }
@@ -231,17 +622,19 @@ private:
 
     RBTree(RBTree &&other) noexcept
         : root(other.root), node_count(other.node_count),
-          comp(std::move(other.comp)) {
+          comp(std::move(other.comp)), alloc(std::move(other.alloc)) {
       other.root = nullptr;
       other.node_count = 0;
     }
 
     RBTree &operator=(RBTree &&other) noexcept {
       if (this != &other) {
-        clear(root);
+        clearAll();
         root = other.root;
         node_count = other.node_count;
         comp = std::move(other.comp);
+        if constexpr (NodeTraits::propagate_on_container_move_assignment::value)
+          alloc = std::move(other.alloc);
         other.root = nullptr;
         other.node_count = 0;
       }
@@ -254,7 +647,37 @@ private:
         return;
       clear(x->left);
       clear(x->right);
-      delete x;
+      destroyNode(x);
+    }
+
+    // Drop the whole tree. Arena allocators are released in one step; the
+    // per-node walk only remains when keys need their destructors run.
+    void clearAll() {
+      if constexpr (requires(NodeAlloc &a) { a.release(); }) {
+        if constexpr (!std::is_trivially_destructible_v<Key>)
+          clear(root);
+        alloc.release();
+      } else {
+        clear(root);
+      }
+      root = nullptr;
+      node_count = 0;
+    }
+
+    // Replace the contents with the strictly increasing keys in O(n)
+    void assignSorted(const std::vector<Key> &keys) {
+      clearAll();
+      size_t red_depth = 0;
+      while ((size_t(2) << red_depth) <= keys.size())
+        ++red_depth;
+      try {
+        buildTree(root, nullptr, keys.data(), keys.size(), 0, red_depth);
+      } catch (...) {
+        clear(root);
+        root = nullptr;
+        throw;
+      }
+      node_count = keys.size();
     }
 
     // Return the minimum node in subtree rooted at x
@@ -295,9 +718,11 @@ private:
       return y;
     }
 
-    // Insert key into the tree, return pair of node and insertion success
+    // Insert key into the tree, return pair of node and insertion success.
+    // The node is only allocated once the key is known to be new.
+    template <class K>
     __attribute__((always_inline)) inline std::pair<Node *, bool>
-    insert(const Key &key) {
+    insert(K &&key) {
       Node *y = nullptr;
       Node *x = root;
       while (x) {
@@ -310,17 +735,99 @@ private:
           return {x, false};
       }
 
-      Node *z = new Node(key, y, nullptr, nullptr, RED);
+      bool as_left = y && comp(key, y->key);
+      return {attach(createNode(y, RED, std::forward<K>(key)), y, as_left),
+              true};
+    }
+
+    // Build the node from args first and search with its key, for keys
+    // that can only be compared once constructed; a duplicate goes straight
+    // back to the allocator
+    template <class... Args> std::pair<Node *, bool> emplace(Args &&...args) {
+      Node *z = createNode(nullptr, RED, std::forward<Args>(args)...);
+      Node *y = nullptr;
+      Node *x = root;
+      while (x) {
+        y = x;
+        if (comp(z->key, x->key)) {
+          x = x->left;
+        } else if (comp(x->key, z->key)) {
+          x = x->right;
+        } else {
+          destroyNode(z);
+          return {x, false};
+        }
+      }
+      z->parent = y;
+      return {attach(z, y, y && comp(z->key, y->key)), true};
+    }
+
+    // Hang the detached node z below y (as the root when y is nullptr) and
+    // rebalance; the slot y->left or y->right must be empty
+    __attribute__((always_inline)) inline Node *attach(Node *z, Node *y,
+                                                       bool as_left) {
       if (!y)
         root = z;
-      else if (comp(z->key, y->key))
+      else if (as_left)
         y->left = z;
       else
         y->right = z;
+      for (Node *p = y; p; p = p->parent)
+        ++p->size;
 
       insertFixup(z);
       ++node_count;
-      return {z, true};
+      return z;
+    }
+
+    // New node for key below y, see attach()
+    template <class K> Node *link(K &&key, Node *y, bool as_left) {
+      return attach(createNode(y, RED, std::forward<K>(key)), y, as_left);
+    }
+
+    // Insert key next to the finger x (nullptr stands for end()). When key
+    // belongs right next to x, or after the maximum for an end() hint, the
+    // node is linked without a search; otherwise the search starts from the
+    // lowest ancestor of x that can hold key.
+    template <class K> std::pair<Node *, bool> insertHint(Node *x, K &&key) {
+      if (!root)
+        return {link(std::forward<K>(key), nullptr, false), true};
+      Node *parent = nullptr;
+      bool as_left = false;
+      if (!x) {
+        x = maximum(root);
+        if (comp(x->key, key))
+          parent = x;
+      } else if (comp(key, x->key)) {
+        Node *pred = predecessor(x);
+        if (!pred || comp(pred->key, key)) {
+          parent = x->left ? pred : x;
+          as_left = !x->left;
+        }
+      } else if (comp(x->key, key)) {
+        Node *succ = successor(x);
+        if (!succ || comp(key, succ->key)) {
+          parent = x->right ? succ : x;
+          as_left = x->right != nullptr;
+        }
+      }
+      if (!parent) {
+        Node *hi;
+        Node *y = fingerStart(x, key, hi);
+        if (hi && !comp(key, hi->key))
+          return {hi, false};
+        while (y) {
+          parent = y;
+          if (comp(key, y->key))
+            y = y->left;
+          else if (comp(y->key, key))
+            y = y->right;
+          else
+            return {y, false};
+        }
+        as_left = comp(key, parent->key);
+      }
+      return {link(std::forward<K>(key), parent, as_left), true};
     }
 
     // Erase node with given key, return number of nodes erased (0 or 1)
@@ -342,6 +849,13 @@ private:
       Node *x_parent = nullptr;
       Color y_original_color = y->color;
 
+      // The node physically unlinked is z itself, or its successor when z
+      // has two children; every ancestor of that position loses one node.
+      for (Node *p = (z->left && z->right) ? minimum(z->right)->parent
+                                           : z->parent;
+           p; p = p->parent)
+        --p->size;
+
       if (!z->left) {
         x = z->right;
         x_parent = z->parent;
@@ -393,9 +907,10 @@ private:
         if (y->left)
           y->left->parent = y;
         y->color = z->color;
+        y->size = z->size;
       }
 
-      delete z;
+      destroyNode(z);
       --node_count;
 
       if (y_original_color == BLACK)
@@ -404,8 +919,10 @@ private:
       return 1;
     }
 
-    // Find node with given key or return nullptr
-    __attribute__((always_inline)) inline Node *find(const Key &key) const {
+    // Find node with given key or return nullptr. K is Key, or any type the
+    // comparator accepts when it is transparent; likewise below.
+    template <class K>
+    __attribute__((always_inline)) inline Node *find(const K &key) const {
       Node *x = root;
       while (x) {
         if (comp(key, x->key))
@@ -419,8 +936,9 @@ private:
     }
 
     // Find node with smallest key >= given key
+    template <class K>
     __attribute__((always_inline)) inline Node *
-    lower_bound(const Key &key) const {
+    lower_bound(const K &key) const {
       Node *x = root;
       Node *res = nullptr;
       while (x) {
@@ -434,9 +952,104 @@ private:
       return res;
     }
 
+    // Finger search: the lowest node on the path from x to the root whose
+    // subtree holds every key between x->key and key. hi receives the
+    // nearest ancestor just above that subtree on the right, which bounds
+    // it from above (nullptr if there is none). The climb stops after about
+    // log d levels for a target d positions away.
+    Node *fingerStart(Node *x, const Key &key, Node *&hi) const {
+      hi = nullptr;
+      if (comp(x->key, key)) {
+        // Target is right of x: stop below the first ancestor not less
+        // than key that x reaches through a left link
+        for (Node *p = x->parent; p; x = p, p = p->parent)
+          if (x == p->left && !comp(p->key, key)) {
+            hi = p;
+            return x;
+          }
+        return x;
+      }
+      // Target is at or left of x: stop below the first ancestor less than
+      // key that x reaches through a right link. x itself is not less than
+      // key, so the subtree always holds the answer.
+      for (Node *p = x->parent; p; x = p, p = p->parent)
+        if (x == p->right && comp(p->key, key))
+          return x;
+      return x;
+    }
+
+    // lower_bound starting from the finger x (nullptr stands for end())
+    Node *lowerBoundFrom(Node *x, const Key &key) const {
+      if (!root)
+        return nullptr;
+      Node *res;
+      x = fingerStart(x ? x : maximum(root), key, res);
+      while (x) {
+        if (!comp(x->key, key)) {
+          res = x;
+          x = x->left;
+        } else {
+          x = x->right;
+        }
+      }
+      return res;
+    }
+
+    // Batched search: emit(i, node) receives find(keys[i]), or
+    // lower_bound(keys[i]) when Lower is set. GROUP searches advance one
+    // level per round and prefetch the child each one visits next, so their
+    // cache misses overlap instead of stalling one after another.
+    template <bool Lower, class Emit>
+    void searchMany(const Key *keys, size_t n, Emit &&emit) const {
+      constexpr size_t GROUP = 16;
+      Node *cur[GROUP];
+      Node *res[GROUP];
+      for (size_t base = 0; base < n; base += GROUP) {
+        size_t m = std::min(GROUP, n - base);
+        for (size_t i = 0; i < m; ++i) {
+          cur[i] = root;
+          res[i] = nullptr;
+        }
+        for (size_t active = root ? m : 0; active;) {
+          active = 0;
+          for (size_t i = 0; i < m; ++i) {
+            Node *x = cur[i];
+            if (!x)
+              continue;
+            const Key &key = keys[base + i];
+            if constexpr (Lower) {
+              if (!comp(x->key, key)) {
+                res[i] = x;
+                x = x->left;
+              } else {
+                x = x->right;
+              }
+            } else {
+              if (comp(key, x->key)) {
+                x = x->left;
+              } else if (comp(x->key, key)) {
+                x = x->right;
+              } else {
+                res[i] = x;
+                x = nullptr;
+              }
+            }
+            if (x) {
+              __builtin_prefetch(x);
+              ++active;
+            }
+            cur[i] = x;
+          }
+        }
+        for (size_t i = 0; i < m; ++i)
+          emit(base + i, res[i]);
+      }
+    }
+
     // Find node with smallest key > given key
+    template <class K>
     __attribute__((always_inline)) inline Node *
-    upper_bound(const Key &key) const {
+    upper_bound(const K &key) const {
       Node *x = root;
       Node *res = nullptr;
       while (x) {
@@ -450,6 +1063,67 @@ private:
       return res;
     }
 
+    // Number of keys strictly less than key
+    __attribute__((always_inline)) inline size_t rank(const Key &key) const {
+      Node *x = root;
+      size_t r = 0;
+      while (x) {
+        if (comp(x->key, key)) {
+          r += sizeOf(x->left) + 1;
+          x = x->right;
+        } else {
+          x = x->left;
+        }
+      }
+      return r;
+    }
+
+    // Number of keys strictly less than or equal to key
+    __attribute__((always_inline)) inline size_t
+    rankUpper(const Key &key) const {
+      Node *x = root;
+      size_t r = 0;
+      while (x) {
+        if (comp(key, x->key)) {
+          x = x->left;
+        } else {
+          r += sizeOf(x->left) + 1;
+          x = x->right;
+        }
+      }
+      return r;
+    }
+
+    // In-order position of node x, nullptr maps to node_count
+    __attribute__((always_inline)) inline size_t indexOf(Node *x) const {
+      if (!x)
+        return node_count;
+      size_t r = sizeOf(x->left);
+      for (; x->parent; x = x->parent)
+        if (x == x->parent->right)
+          r += sizeOf(x->parent->left) + 1;
+      return r;
+    }
+
+    // Node at in-order position k (0-based), nullptr if k is out of range
+    __attribute__((always_inline)) inline Node *select(size_t k) const {
+      if (k >= node_count)
+        return nullptr;
+      Node *x = root;
+      while (x) {
+        size_t l = sizeOf(x->left);
+        if (k < l) {
+          x = x->left;
+        } else if (k == l) {
+          return x;
+        } else {
+          k -= l + 1;
+          x = x->right;
+        }
+      }
+      return nullptr;
+    }
+
     __attribute__((always_inline)) inline size_t size() const {
       return node_count;
     }
@@ -458,9 +1132,17 @@ private:
 
   RBTree tree;
 
+  // Batched lookups write one result per key into out
+  static void checkBatch(size_t keys, size_t out) {
+    if (out < keys)
+      throw std::invalid_argument("output span shorter than keys");
+  }
+
 public:
   // Const iterator for ESet, supports in-order traversal
   class const_iterator {
+    friend class ESet;
+
   protected:
     const RBTree *tree;
     Node *node;
@@ -507,6 +1189,29 @@ public:
       return tmp;
     }
 
+    // Jump n positions in O(log n) using subtree sizes; moving past either
+    // end yields end()
+    const_iterator &operator+=(std::ptrdiff_t n) {
+      if (!tree || n == 0)
+        return *this;
+      std::ptrdiff_t target =
+          static_cast<std::ptrdiff_t>(tree->indexOf(node)) + n;
+      node = target < 0 ? nullptr : tree->select(static_cast<size_t>(target));
+      return *this;
+    }
+
+    const_iterator &operator-=(std::ptrdiff_t n) { return *this += -n; }
+
+    const_iterator operator+(std::ptrdiff_t n) const {
+      const_iterator tmp = *this;
+      return tmp += n;
+    }
+
+    const_iterator operator-(std::ptrdiff_t n) const {
+      const_iterator tmp = *this;
+      return tmp -= n;
+    }
+
     bool operator==(const const_iterator &rhs) const {
       return node == rhs.node;
     }
@@ -529,6 +1234,12 @@ public:
   }
 
   ESet(ESet &&other) noexcept : tree(std::move(other.tree)) {}
+
+  // Build from [first, last) in O(n) for sorted input, see assign()
+  template <class InputIt> ESet(InputIt first, InputIt last) {
+    assign(first, last);
+  }
+
   ESet &operator=(ESet &&other) noexcept {
     if (this != &other) {
       tree = std::move(other.tree);
@@ -538,41 +1249,118 @@ public:
 
   // TODO: Consider adding more public API functions for extensibility
 
-  // Insert element with given arguments, returns iterator and success flag
+  // Insert element with given arguments, returns iterator and success flag.
+  // The key is constructed directly inside the node; a lone Key argument
+  // is searched for first, so a duplicate costs no allocation.
   template <class... Args> std::pair<iterator, bool> emplace(Args &&...args) {
-    Key key(std::forward<Args>(args)...);
+    if constexpr (sizeof...(Args) == 1 &&
+                  (std::is_same_v<std::remove_cvref_t<Args>, Key> && ...)) {
+      return insert(std::forward<Args>(args)...);
+    } else {
+      auto [node, inserted] = tree.emplace(std::forward<Args>(args)...);
+      return {iterator(&tree, node), inserted};
+    }
+  }
+
+  // Insert key, copying or moving it into a node only when it is new
+  std::pair<iterator, bool> insert(const Key &key) {
     auto [node, inserted] = tree.insert(key);
     return {iterator(&tree, node), inserted};
   }
 
+  std::pair<iterator, bool> insert(Key &&key) {
+    auto [node, inserted] = tree.insert(std::move(key));
+    return {iterator(&tree, node), inserted};
+  }
+
+  // Insert key using hint as a starting point. No search is done when key
+  // belongs right next to hint (end() means after the last element), so
+  // appending sorted keys with hint end() or the previous result compares
+  // only two keys; otherwise the search starts from the nearest ancestor of
+  // hint whose subtree can hold key. Returns the element equal to key.
+  template <class... Args>
+  iterator emplace_hint(const_iterator hint, Args &&...args) {
+    Node *x;
+    if constexpr (sizeof...(Args) == 1 &&
+                  (std::is_same_v<std::remove_cvref_t<Args>, Key> && ...))
+      x = tree.insertHint(hint.node, std::forward<Args>(args)...).first;
+    else
+      x = tree.insertHint(hint.node, Key(std::forward<Args>(args)...)).first;
+    return iterator(&tree, x);
+  }
+
+  // Replace the contents with the keys in [first, last). Strictly sorted
+  // input is linked into a balanced tree in one linear pass; otherwise the
+  // keys are sorted and deduplicated in parallel first, keeping one key of
+  // each group of equivalent ones.
+  template <class InputIt> void assign(InputIt first, InputIt last) {
+    std::vector<Key> keys(first, last);
+    const Compare &comp = tree.comp;
+    auto not_less = [&](const Key &a, const Key &b) { return !comp(a, b); };
+    if (std::adjacent_find(keys.begin(), keys.end(), not_less) != keys.end()) {
+      if (!std::is_sorted(keys.begin(), keys.end(), comp))
+        parallelSort(keys.begin(), keys.end(), comp);
+      keys.erase(parallelUnique(keys.begin(), keys.end(), comp), keys.end());
+    }
+    tree.assignSorted(keys);
+  }
+
+  // Set algebra built on red-black join/split: O(m log(n/m + 1)) work for
+  // sizes m <= n, with the recursion spread over the work-stealing pool.
+  // Both arguments are consumed, so pass them with std::move unless a copy
+  // is wanted.
+  friend ESet set_union(ESet a, ESet b) {
+    a.tree.combine(b.tree, &RBTree::unite);
+    return a;
+  }
+
+  friend ESet set_intersection(ESet a, ESet b) {
+    a.tree.combine(b.tree, &RBTree::intersect);
+    return a;
+  }
+
+  // Keys of a that are not in b
+  friend ESet set_difference(ESet a, ESet b) {
+    a.tree.combine(b.tree, &RBTree::subtract);
+    return a;
+  }
+
   // Erase element by key, returns number of elements erased (0 or 1)
   __attribute__((always_inline)) inline size_t erase(const Key &key) {
     return tree.erase(key);
   }
 
   // Clear all elements from the set
-  void clear() {
-    tree.clear(tree.root);
-    tree.root = nullptr;
-    tree.node_count = 0;
-  }
+  void clear() { tree.clearAll(); }
 
   // Find element by key, return iterator to element or end()
   __attribute__((always_inline)) inline iterator find(const Key &key) const {
     return iterator(&tree, tree.find(key));
   }
 
-  // Count number of elements in range [l, r]
+  // Heterogeneous find, e.g. a std::string_view probe into ESet<std::string,
+  // std::less<>>; only offered when the comparator is transparent
+  template <class K>
+    requires requires { typename Compare::is_transparent; }
+  __attribute__((always_inline)) inline iterator find(const K &key) const {
+    return iterator(&tree, tree.find(key));
+  }
+
+  // Count number of elements in range [l, r] in O(log n)
   size_t range(const Key &l, const Key &r) const {
     if (tree.comp(r, l))
       return 0;
-    size_t cnt = 0;
-    auto it = lower_bound(l);
-    auto end_it = upper_bound(r);
-    for (; it != end_it; ++it) {
-      ++cnt;
-    }
-    return cnt;
+    return tree.rankUpper(r) - tree.rank(l);
+  }
+
+  // Number of elements strictly less than key
+  __attribute__((always_inline)) inline size_t rank(const Key &key) const {
+    return tree.rank(key);
+  }
+
+  // Iterator to the k-th smallest element (0-based), end() if k >= size()
+  __attribute__((always_inline)) inline iterator select(size_t k) const {
+    return iterator(&tree, tree.select(k));
   }
 
   __attribute__((always_inline)) inline size_t size() const noexcept {
@@ -591,6 +1379,67 @@ public:
     return iterator(&tree, tree.upper_bound(key));
   }
 
+  // Heterogeneous bounds for transparent comparators, see find()
+  template <class K>
+    requires requires { typename Compare::is_transparent; }
+  __attribute__((always_inline)) inline iterator
+  lower_bound(const K &key) const {
+    return iterator(&tree, tree.lower_bound(key));
+  }
+
+  template <class K>
+    requires requires { typename Compare::is_transparent; }
+  __attribute__((always_inline)) inline iterator
+  upper_bound(const K &key) const {
+    return iterator(&tree, tree.upper_bound(key));
+  }
+
+  // Batched lookups: out[i] receives the result for keys[i]. Probing many
+  // keys at once overlaps their cache misses, which pays off once the tree
+  // no longer fits in cache. out must be at least as long as keys.
+  void find_many(std::span<const Key> keys, std::span<iterator> out) const {
+    checkBatch(keys.size(), out.size());
+    tree.template searchMany<false>(
+        keys.data(), keys.size(),
+        [&](size_t i, Node *x) { out[i] = iterator(&tree, x); });
+  }
+
+  void contains_many(std::span<const Key> keys, std::span<bool> out) const {
+    checkBatch(keys.size(), out.size());
+    contains_many(keys, out.begin());
+  }
+
+  // Writes keys.size() results through out in order and returns the
+  // iterator past the last one, so std::vector<bool>::iterator and
+  // std::back_inserter work too
+  template <class Out>
+    requires requires(Out out) { *out++ = true; }
+  Out contains_many(std::span<const Key> keys, Out out) const {
+    tree.template searchMany<false>(
+        keys.data(), keys.size(),
+        [&](size_t, Node *x) { *out++ = x != nullptr; });
+    return out;
+  }
+
+  void lower_bound_many(std::span<const Key> keys,
+                        std::span<iterator> out) const {
+    checkBatch(keys.size(), out.size());
+    tree.template searchMany<true>(
+        keys.data(), keys.size(),
+        [&](size_t i, Node *x) { out[i] = iterator(&tree, x); });
+  }
+
+  // lower_bound / find starting from it instead of the root; cost grows
+  // with the distance between *it and key rather than with size()
+  iterator lower_bound(const_iterator it, const Key &key) const {
+    return iterator(&tree, tree.lowerBoundFrom(it.node, key));
+  }
+
+  iterator find(const_iterator it, const Key &key) const {
+    Node *x = tree.lowerBoundFrom(it.node, key);
+    return iterator(&tree, x && !tree.comp(key, x->key) ? x : nullptr);
+  }
+
   // Return iterator to smallest element
   __attribute__((always_inline)) inline iterator begin() const noexcept {
     return iterator(&tree, tree.minimum(tree.getRoot()));
@@ -601,6 +1450,16 @@ public:
     return iterator(&tree, nullptr);
   }
 
+  // Immutable read-optimized snapshot of the current contents; later
+  // changes to this set do not affect it
+  FrozenESet<Key, Compare> freeze() const {
+    std::vector<Key> keys;
+    keys.reserve(size());
+    for (const Key &key : *this)
+      keys.push_back(key);
+    return FrozenESet<Key, Compare>(keys, tree.comp);
+  }
+
   __attribute__((always_inline)) inline Node *getRoot() const {
     return tree.getRoot();
   }
@@ -0,0 +1,511 @@
+#ifndef SJTU_ESET_BPLUS_HPP
+#define SJTU_ESET_BPLUS_HPP
+
+#include "Eset_common.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+//  BPlusESet: B+tree with the ESet interface.
+//  Every node holds four cache lines of keys, so a lookup in a million-key
+//  set visits 4-5 nodes instead of ~20 red-black nodes. All keys live in
+//  the leaves, which are doubly linked, so iteration and range() scan
+//  arrays sequentially. For arithmetic keys under DefaultLess the unused
+//  slots are padded with the largest value and a node is searched with a
+//  fixed-width, branch-free count the compiler turns into SIMD compares;
+//  other keys use binary search. Keys must be default constructible.
+//  Insert and erase invalidate iterators into the touched leaves.
+
+template <class Key, class Compare = DefaultLess<Key>> class BPlusESet {
+private:
+  static constexpr size_t CACHE_LINE = 64;
+  static constexpr int N = sizeof(Key) <= CACHE_LINE / 2
+                               ? static_cast<int>(4 * CACHE_LINE / sizeof(Key))
+                               : 8;
+  static constexpr int MIN_LEAF = N / 2;
+  static constexpr int MIN_INNER = (N - 1) / 2;
+  static constexpr bool SIMD_SEARCH =
+      std::is_arithmetic_v<Key> && std::is_same_v<Compare, DefaultLess<Key>>;
+
+  // Largest value of Key, which fills the unused slots under SIMD_SEARCH
+  static Key padKey() {
+    if constexpr (std::numeric_limits<Key>::has_infinity)
+      return std::numeric_limits<Key>::infinity();
+    else
+      return std::numeric_limits<Key>::max();
+  }
+
+  struct alignas(CACHE_LINE) Node {
+    Key keys[N];
+    int count;
+    bool leaf;
+
+    explicit Node(bool is_leaf) : count(0), leaf(is_leaf) {
+      if constexpr (SIMD_SEARCH)
+        std::fill(keys, keys + N, padKey());
+    }
+  };
+
+  struct Leaf : Node {
+    Leaf *prev;
+    Leaf *next;
+
+    Leaf() : Node(true), prev(nullptr), next(nullptr) {}
+  };
+
+  struct Inner : Node {
+    Node *children[N + 1];
+
+    Inner() : Node(false) {}
+  };
+
+  Node *root;
+  Leaf *head; // leftmost leaf
+  Leaf *tail; // rightmost leaf
+  size_t node_count;
+  Compare comp;
+
+  static Leaf *asLeaf(Node *x) { return static_cast<Leaf *>(x); }
+  static Inner *asInner(Node *x) { return static_cast<Inner *>(x); }
+
+  // Keep the slots past count at the padding value after keys moved out
+  static void pad(Node *x) {
+    if constexpr (SIMD_SEARCH)
+      std::fill(x->keys + x->count, x->keys + N, padKey());
+  }
+
+  // Number of keys in x that are less than key
+  __attribute__((always_inline)) inline int countLess(const Node *x,
+                                                      const Key &key) const {
+    if constexpr (SIMD_SEARCH) {
+      int cnt = 0;
+      for (int i = 0; i < N; ++i)
+        cnt += x->keys[i] < key;
+      // Clamped like countNotGreater, so padding is never counted
+      return std::min(cnt, x->count);
+    } else {
+      return static_cast<int>(
+          std::lower_bound(x->keys, x->keys + x->count, key, comp) - x->keys);
+    }
+  }
+
+  // Number of keys in x that are not greater than key
+  __attribute__((always_inline)) inline int
+  countNotGreater(const Node *x, const Key &key) const {
+    if constexpr (SIMD_SEARCH) {
+      int cnt = 0;
+      for (int i = 0; i < N; ++i)
+        cnt += !(key < x->keys[i]);
+      // Padding equals key when key is the largest value
+      return std::min(cnt, x->count);
+    } else {
+      return static_cast<int>(
+          std::upper_bound(x->keys, x->keys + x->count, key, comp) - x->keys);
+    }
+  }
+
+  // Leaf whose range covers key
+  __attribute__((always_inline)) inline Leaf *findLeaf(const Key &key) const {
+    Node *x = root;
+    while (!x->leaf)
+      x = asInner(x)->children[countNotGreater(x, key)];
+    return asLeaf(x);
+  }
+
+  // Split the full child i of p into two siblings
+  void splitChild(Inner *p, int i) {
+    Node *c = p->children[i];
+    Node *r;
+    Key separator;
+    int mid = N / 2;
+    if (c->leaf) {
+      Leaf *l = asLeaf(c);
+      Leaf *nl = new Leaf();
+      std::move(c->keys + mid, c->keys + N, nl->keys);
+      nl->count = N - mid;
+      nl->next = l->next;
+      nl->prev = l;
+      if (l->next)
+        l->next->prev = nl;
+      else
+        tail = nl;
+      l->next = nl;
+      separator = nl->keys[0];
+      r = nl;
+    } else {
+      Inner *ni = new Inner();
+      separator = std::move(c->keys[mid]);
+      std::move(c->keys + mid + 1, c->keys + N, ni->keys);
+      std::copy(asInner(c)->children + mid + 1, asInner(c)->children + N + 1,
+                ni->children);
+      ni->count = N - mid - 1;
+      r = ni;
+    }
+    c->count = mid;
+    pad(c);
+    std::move_backward(p->keys + i, p->keys + p->count,
+                       p->keys + p->count + 1);
+    std::copy_backward(p->children + i + 1, p->children + p->count + 1,
+                       p->children + p->count + 2);
+    p->keys[i] = std::move(separator);
+    p->children[i + 1] = r;
+    ++p->count;
+  }
+
+  // Merge child j + 1 of p into child j
+  void mergeChildren(Inner *p, int j) {
+    Node *l = p->children[j];
+    Node *r = p->children[j + 1];
+    if (l->leaf) {
+      std::move(r->keys, r->keys + r->count, l->keys + l->count);
+      l->count += r->count;
+      asLeaf(l)->next = asLeaf(r)->next;
+      if (asLeaf(r)->next)
+        asLeaf(r)->next->prev = asLeaf(l);
+      else
+        tail = asLeaf(l);
+      delete asLeaf(r);
+    } else {
+      l->keys[l->count] = std::move(p->keys[j]);
+      std::move(r->keys, r->keys + r->count, l->keys + l->count + 1);
+      std::copy(asInner(r)->children, asInner(r)->children + r->count + 1,
+                asInner(l)->children + l->count + 1);
+      l->count += r->count + 1;
+      delete asInner(r);
+    }
+    std::move(p->keys + j + 1, p->keys + p->count, p->keys + j);
+    std::copy(p->children + j + 2, p->children + p->count + 1,
+              p->children + j + 1);
+    --p->count;
+    pad(p);
+  }
+
+  // Child i of p fell below the minimum: borrow from a sibling or merge
+  void rebalance(Inner *p, int i) {
+    Node *c = p->children[i];
+    int min = c->leaf ? MIN_LEAF : MIN_INNER;
+    if (i > 0 && p->children[i - 1]->count > min) {
+      Node *l = p->children[i - 1];
+      std::move_backward(c->keys, c->keys + c->count,
+                         c->keys + c->count + 1);
+      if (c->leaf) {
+        c->keys[0] = std::move(l->keys[l->count - 1]);
+        p->keys[i - 1] = c->keys[0];
+      } else {
+        std::copy_backward(asInner(c)->children,
+                           asInner(c)->children + c->count + 1,
+                           asInner(c)->children + c->count + 2);
+        c->keys[0] = std::move(p->keys[i - 1]);
+        asInner(c)->children[0] = asInner(l)->children[l->count];
+        p->keys[i - 1] = std::move(l->keys[l->count - 1]);
+      }
+      ++c->count;
+      --l->count;
+      pad(l);
+    } else if (i < p->count && p->children[i + 1]->count > min) {
+      Node *r = p->children[i + 1];
+      if (c->leaf) {
+        c->keys[c->count] = std::move(r->keys[0]);
+      } else {
+        c->keys[c->count] = std::move(p->keys[i]);
+        asInner(c)->children[c->count + 1] = asInner(r)->children[0];
+        p->keys[i] = std::move(r->keys[0]);
+        std::copy(asInner(r)->children + 1,
+                  asInner(r)->children + r->count + 1, asInner(r)->children);
+      }
+      ++c->count;
+      std::move(r->keys + 1, r->keys + r->count, r->keys);
+      --r->count;
+      pad(r);
+      if (c->leaf)
+        p->keys[i] = r->keys[0];
+    } else {
+      mergeChildren(p, i > 0 ? i - 1 : i);
+    }
+  }
+
+  // Erase key below x, returns whether it was found
+  bool eraseFrom(Node *x, const Key &key) {
+    if (x->leaf) {
+      int pos = countLess(x, key);
+      if (pos == x->count || comp(key, x->keys[pos]))
+        return false;
+      std::move(x->keys + pos + 1, x->keys + x->count, x->keys + pos);
+      --x->count;
+      pad(x);
+      return true;
+    }
+    Inner *in = asInner(x);
+    int i = countNotGreater(x, key);
+    if (!eraseFrom(in->children[i], key))
+      return false;
+    Node *c = in->children[i];
+    if (c->count < (c->leaf ? MIN_LEAF : MIN_INNER))
+      rebalance(in, i);
+    return true;
+  }
+
+  static void destroy(Node *x) {
+    if (!x)
+      return;
+    if (x->leaf) {
+      delete asLeaf(x);
+      return;
+    }
+    for (int i = 0; i <= x->count; ++i)
+      destroy(asInner(x)->children[i]);
+    delete asInner(x);
+  }
+
+  // Deep copy of x; copied leaves are chained after last
+  static Node *copyNode(const Node *x, Leaf *&last, Leaf *&first) {
+    if (x->leaf) {
+      Leaf *l = new Leaf();
+      std::copy(x->keys, x->keys + N, l->keys);
+      l->count = x->count;
+      l->prev = last;
+      if (last)
+        last->next = l;
+      else
+        first = l;
+      last = l;
+      return l;
+    }
+    Inner *in = new Inner();
+    std::copy(x->keys, x->keys + N, in->keys);
+    in->count = x->count;
+    for (int i = 0; i <= x->count; ++i)
+      in->children[i] =
+          copyNode(asInner(const_cast<Node *>(x))->children[i], last, first);
+    return in;
+  }
+
+public:
+  // Bidirectional iterator: a leaf and a slot in it
+  class const_iterator {
+    friend class BPlusESet;
+
+  private:
+    const BPlusESet *set;
+    Leaf *leaf; // nullptr means end()
+    int pos;
+
+    // Step to the next leaf when pos ran off the end of this one
+    void normalize() {
+      if (leaf && pos == leaf->count) {
+        leaf = leaf->next;
+        pos = 0;
+      }
+    }
+
+  public:
+    const_iterator(const BPlusESet *s = nullptr, Leaf *l = nullptr, int p = 0)
+        : set(s), leaf(l), pos(p) {
+      normalize();
+    }
+
+    __attribute__((always_inline)) inline const Key &operator*() const {
+      if (!leaf)
+        throw std::out_of_range("dereferencing end iterator");
+      return leaf->keys[pos];
+    }
+
+    __attribute__((always_inline)) inline const_iterator &operator++() {
+      if (!leaf)
+        return *this;
+      ++pos;
+      normalize();
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+
+    __attribute__((always_inline)) inline const_iterator &operator--() {
+      if (!leaf) {
+        if (!set || !set->tail)
+          return *this;
+        leaf = set->tail;
+        pos = leaf->count - 1;
+      } else if (pos > 0) {
+        --pos;
+      } else if (leaf->prev) {
+        leaf = leaf->prev;
+        pos = leaf->count - 1;
+      }
+      return *this;
+    }
+
+    const_iterator operator--(int) {
+      const_iterator tmp = *this;
+      --(*this);
+      return tmp;
+    }
+
+    bool operator==(const const_iterator &rhs) const {
+      return leaf == rhs.leaf && (!leaf || pos == rhs.pos);
+    }
+    bool operator!=(const const_iterator &rhs) const { return !(*this == rhs); }
+  };
+
+  using iterator = const_iterator;
+
+  BPlusESet()
+      : root(nullptr), head(nullptr), tail(nullptr), node_count(0),
+        comp(Compare()) {}
+  ~BPlusESet() { destroy(root); }
+
+  BPlusESet(const BPlusESet &other)
+      : root(nullptr), head(nullptr), tail(nullptr),
+        node_count(other.node_count), comp(other.comp) {
+    if (other.root)
+      root = copyNode(other.root, tail, head);
+  }
+
+  BPlusESet &operator=(const BPlusESet &other) {
+    if (this != &other) {
+      BPlusESet tmp(other);
+      swap(tmp);
+    }
+    return *this;
+  }
+
+  BPlusESet(BPlusESet &&other) noexcept : BPlusESet() { swap(other); }
+  BPlusESet &operator=(BPlusESet &&other) noexcept {
+    if (this != &other) {
+      clear();
+      swap(other);
+    }
+    return *this;
+  }
+
+  void swap(BPlusESet &other) noexcept {
+    std::swap(root, other.root);
+    std::swap(head, other.head);
+    std::swap(tail, other.tail);
+    std::swap(node_count, other.node_count);
+    std::swap(comp, other.comp);
+  }
+
+  // Insert element with given arguments, returns iterator and success flag.
+  // Full nodes are split on the way down, so the leaf always has room.
+  template <class... Args> std::pair<iterator, bool> emplace(Args &&...args) {
+    Key key(std::forward<Args>(args)...);
+    if (!root)
+      root = head = tail = new Leaf();
+    if (root->count == N) {
+      Inner *r = new Inner();
+      r->children[0] = root;
+      splitChild(r, 0);
+      root = r;
+    }
+    Node *x = root;
+    while (!x->leaf) {
+      Inner *in = asInner(x);
+      int i = countNotGreater(x, key);
+      if (in->children[i]->count == N) {
+        splitChild(in, i);
+        if (!comp(key, in->keys[i]))
+          ++i;
+      }
+      x = in->children[i];
+    }
+    Leaf *leaf = asLeaf(x);
+    int pos = countLess(leaf, key);
+    if (pos < leaf->count && !comp(key, leaf->keys[pos]))
+      return {iterator(this, leaf, pos), false};
+    std::move_backward(leaf->keys + pos, leaf->keys + leaf->count,
+                       leaf->keys + leaf->count + 1);
+    leaf->keys[pos] = std::move(key);
+    ++leaf->count;
+    ++node_count;
+    return {iterator(this, leaf, pos), true};
+  }
+
+  // Erase element by key, returns number of elements erased (0 or 1)
+  size_t erase(const Key &key) {
+    if (!root || !eraseFrom(root, key))
+      return 0;
+    --node_count;
+    if (!root->leaf && root->count == 0) {
+      Inner *old = asInner(root);
+      root = old->children[0];
+      delete old;
+    } else if (root->leaf && root->count == 0) {
+      delete asLeaf(root);
+      root = head = tail = nullptr;
+    }
+    return 1;
+  }
+
+  // Clear all elements from the set
+  void clear() {
+    destroy(root);
+    root = head = tail = nullptr;
+    node_count = 0;
+  }
+
+  // Find element by key, return iterator to element or end()
+  __attribute__((always_inline)) inline iterator find(const Key &key) const {
+    iterator it = lower_bound(key);
+    if (it.leaf && comp(key, *it))
+      return end();
+    return it;
+  }
+
+  // Return iterator to first element not less than key
+  __attribute__((always_inline)) inline iterator
+  lower_bound(const Key &key) const {
+    if (!root)
+      return end();
+    Leaf *leaf = findLeaf(key);
+    return iterator(this, leaf, countLess(leaf, key));
+  }
+
+  // Return iterator to first element greater than key
+  __attribute__((always_inline)) inline iterator
+  upper_bound(const Key &key) const {
+    if (!root)
+      return end();
+    Leaf *leaf = findLeaf(key);
+    return iterator(this, leaf, countNotGreater(leaf, key));
+  }
+
+  // Count number of elements in range [l, r], one leaf at a time
+  size_t range(const Key &l, const Key &r) const {
+    if (comp(r, l) || !root)
+      return 0;
+    iterator lo = lower_bound(l);
+    iterator hi = upper_bound(r);
+    size_t cnt = 0;
+    Leaf *leaf = lo.leaf;
+    int pos = lo.pos;
+    for (; leaf && leaf != hi.leaf; leaf = leaf->next, pos = 0)
+      cnt += leaf->count - pos;
+    if (leaf)
+      cnt += hi.pos - pos;
+    return cnt;
+  }
+
+  __attribute__((always_inline)) inline size_t size() const noexcept {
+    return node_count;
+  }
+
+  // Return iterator to smallest element
+  __attribute__((always_inline)) inline iterator begin() const noexcept {
+    return iterator(this, head, 0);
+  }
+
+  // Return iterator to end (past last element)
+  __attribute__((always_inline)) inline iterator end() const noexcept {
+    return iterator(this, nullptr, 0);
+  }
+};
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef SJTU_ESET_COMMON_HPP
+#define SJTU_ESET_COMMON_HPP
+
+// Pieces shared by every ESet flavour in this directory
+
+template <typename T> struct DefaultLess {
+  bool operator()(const T &a, const T &b) const { return a < b; }
+};
+
+#endif
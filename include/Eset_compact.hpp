@@ -0,0 +1,408 @@
+#ifndef SJTU_ESET_COMPACT_HPP
+#define SJTU_ESET_COMPACT_HPP
+
+#include "Eset_common.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+//  CompactESet: memory-lean variant of ESet for very large sets.
+//  Nodes live in one vector and refer to each other by 32-bit index; the
+//  color is packed into the top bit of the left index and there is no
+//  parent link, so an int node takes 12 bytes instead of 48. Balancing
+//  uses the left-leaning red-black rules, whose recursive insert and erase
+//  need no parent pointers, and iterators carry their root-to-node path.
+//  Any insert or erase invalidates outstanding iterators. range() walks the
+//  interval, since subtree sizes are left out to keep the nodes small.
+
+template <class Key, class Compare = DefaultLess<Key>> class CompactESet {
+private:
+  using Index = std::uint32_t;
+
+  static constexpr Index NIL = 0;
+  static constexpr Index RED_BIT = Index(1) << 31;
+  static constexpr Index MAX_NODES = RED_BIT - 1;
+  // Height bound of a red-black tree with fewer than 2^31 nodes
+  static constexpr int MAX_DEPTH = 64;
+
+  struct Node {
+    Key key;
+    Index left; // left child, top bit set when this node is red
+    Index right;
+
+    template <class K>
+    Node(K &&k) : key(std::forward<K>(k)), left(RED_BIT), right(NIL) {}
+  };
+
+  // Index i lives in nodes[i - 1] so that 0 can mean "no node"
+  std::vector<Node> nodes;
+  Index root;
+  Index free_head; // erased slots, chained through right
+  size_t node_count;
+  Compare comp;
+
+  __attribute__((always_inline)) inline Node &at(Index i) {
+    return nodes[i - 1];
+  }
+  __attribute__((always_inline)) inline const Node &at(Index i) const {
+    return nodes[i - 1];
+  }
+
+  __attribute__((always_inline)) inline Index left(Index i) const {
+    return at(i).left & ~RED_BIT;
+  }
+  __attribute__((always_inline)) inline Index right(Index i) const {
+    return at(i).right;
+  }
+  __attribute__((always_inline)) inline bool isRed(Index i) const {
+    return i != NIL && (at(i).left & RED_BIT);
+  }
+  void setLeft(Index i, Index l) { at(i).left = (at(i).left & RED_BIT) | l; }
+  void setRight(Index i, Index r) { at(i).right = r; }
+  void setRed(Index i, bool red) {
+    at(i).left = red ? (at(i).left | RED_BIT) : (at(i).left & ~RED_BIT);
+  }
+
+  template <class K> Index newNode(K &&key) {
+    if (free_head != NIL) {
+      Index i = free_head;
+      free_head = right(i);
+      at(i).key = std::forward<K>(key);
+      at(i).left = RED_BIT;
+      at(i).right = NIL;
+      return i;
+    }
+    if (nodes.size() >= MAX_NODES)
+      throw std::length_error("CompactESet is full");
+    nodes.emplace_back(std::forward<K>(key));
+    return static_cast<Index>(nodes.size());
+  }
+
+  void freeNode(Index i) {
+    at(i).left = NIL;
+    at(i).right = free_head;
+    free_head = i;
+  }
+
+  Index rotateLeft(Index h) {
+    Index x = right(h);
+    setRight(h, left(x));
+    setLeft(x, h);
+    setRed(x, isRed(h));
+    setRed(h, true);
+    return x;
+  }
+
+  Index rotateRight(Index h) {
+    Index x = left(h);
+    setLeft(h, right(x));
+    setRight(x, h);
+    setRed(x, isRed(h));
+    setRed(h, true);
+    return x;
+  }
+
+  void flipColors(Index h) {
+    setRed(h, !isRed(h));
+    setRed(left(h), !isRed(left(h)));
+    setRed(right(h), !isRed(right(h)));
+  }
+
+  // Restore the left-leaning invariants on the way back up
+  Index balance(Index h) {
+    if (isRed(right(h)) && !isRed(left(h)))
+      h = rotateLeft(h);
+    if (isRed(left(h)) && isRed(left(left(h))))
+      h = rotateRight(h);
+    if (isRed(left(h)) && isRed(right(h)))
+      flipColors(h);
+    return h;
+  }
+
+  Index moveRedLeft(Index h) {
+    flipColors(h);
+    if (isRed(left(right(h)))) {
+      setRight(h, rotateRight(right(h)));
+      h = rotateLeft(h);
+      flipColors(h);
+    }
+    return h;
+  }
+
+  Index moveRedRight(Index h) {
+    flipColors(h);
+    if (isRed(left(left(h)))) {
+      h = rotateRight(h);
+      flipColors(h);
+    }
+    return h;
+  }
+
+  // Insert key below h; inserted reports whether a node was added
+  template <class K> Index insert(Index h, K &&key, bool &inserted) {
+    if (h == NIL) {
+      inserted = true;
+      return newNode(std::forward<K>(key));
+    }
+    if (comp(key, at(h).key)) {
+      Index l = insert(left(h), std::forward<K>(key), inserted);
+      setLeft(h, l);
+    } else if (comp(at(h).key, key)) {
+      Index r = insert(right(h), std::forward<K>(key), inserted);
+      setRight(h, r);
+    } else {
+      return h;
+    }
+    return inserted ? balance(h) : h;
+  }
+
+  Index eraseMin(Index h) {
+    if (left(h) == NIL) {
+      freeNode(h);
+      return NIL;
+    }
+    if (!isRed(left(h)) && !isRed(left(left(h))))
+      h = moveRedLeft(h);
+    setLeft(h, eraseMin(left(h)));
+    return balance(h);
+  }
+
+  // Erase key, which must be present, from the subtree h
+  Index erase(Index h, const Key &key) {
+    if (comp(key, at(h).key)) {
+      if (!isRed(left(h)) && !isRed(left(left(h))))
+        h = moveRedLeft(h);
+      setLeft(h, erase(left(h), key));
+    } else {
+      if (isRed(left(h)))
+        h = rotateRight(h);
+      if (!comp(at(h).key, key) && right(h) == NIL) {
+        freeNode(h);
+        return NIL;
+      }
+      if (!isRed(right(h)) && !isRed(left(right(h))))
+        h = moveRedRight(h);
+      if (!comp(at(h).key, key)) {
+        Index m = right(h);
+        while (left(m) != NIL)
+          m = left(m);
+        at(h).key = std::move(at(m).key);
+        setRight(h, eraseMin(right(h)));
+      } else {
+        setRight(h, erase(right(h), key));
+      }
+    }
+    return balance(h);
+  }
+
+public:
+  // Bidirectional iterator holding the path from the root to its node
+  class const_iterator {
+    friend class CompactESet;
+
+  private:
+    const CompactESet *set;
+    Index path[MAX_DEPTH];
+    int depth; // 0 means end()
+
+    Index node() const { return depth ? path[depth - 1] : NIL; }
+
+    void pushLeftmost(Index x) {
+      for (; x != NIL; x = set->left(x))
+        path[depth++] = x;
+    }
+
+    void pushRightmost(Index x) {
+      for (; x != NIL; x = set->right(x))
+        path[depth++] = x;
+    }
+
+  public:
+    const_iterator(const CompactESet *s = nullptr) : set(s), depth(0) {}
+
+    const Key &operator*() const {
+      if (!depth)
+        throw std::out_of_range("dereferencing end iterator");
+      return set->at(node()).key;
+    }
+
+    const_iterator &operator++() {
+      if (!depth)
+        return *this;
+      Index x = node();
+      if (set->right(x) != NIL) {
+        pushLeftmost(set->right(x));
+        return *this;
+      }
+      // Climb while we are coming back from a right child
+      while (--depth && set->right(path[depth - 1]) == x)
+        x = path[depth - 1];
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+
+    const_iterator &operator--() {
+      if (!depth) {
+        if (set)
+          pushRightmost(set->root);
+        return *this;
+      }
+      Index x = node();
+      if (set->left(x) != NIL) {
+        pushRightmost(set->left(x));
+        return *this;
+      }
+      const_iterator saved = *this;
+      while (--depth && set->left(path[depth - 1]) == x)
+        x = path[depth - 1];
+      // Already at the first element: stay put, like ESet
+      if (!depth)
+        *this = saved;
+      return *this;
+    }
+
+    const_iterator operator--(int) {
+      const_iterator tmp = *this;
+      --(*this);
+      return tmp;
+    }
+
+    bool operator==(const const_iterator &rhs) const {
+      return node() == rhs.node();
+    }
+    bool operator!=(const const_iterator &rhs) const {
+      return node() != rhs.node();
+    }
+  };
+
+  using iterator = const_iterator;
+
+  CompactESet() : root(NIL), free_head(NIL), node_count(0), comp(Compare()) {}
+
+  // Insert element with given arguments, returns iterator and success flag
+  template <class... Args> std::pair<iterator, bool> emplace(Args &&...args) {
+    Key key(std::forward<Args>(args)...);
+    bool inserted = false;
+    root = insert(root, key, inserted);
+    setRed(root, false);
+    if (inserted)
+      ++node_count;
+    return {find(key), inserted};
+  }
+
+  // Erase element by key, returns number of elements erased (0 or 1)
+  size_t erase(const Key &key) {
+    if (!contains(key))
+      return 0;
+    if (!isRed(left(root)) && !isRed(right(root)))
+      setRed(root, true);
+    root = erase(root, key);
+    if (root != NIL)
+      setRed(root, false);
+    --node_count;
+    return 1;
+  }
+
+  void clear() {
+    nodes.clear();
+    root = free_head = NIL;
+    node_count = 0;
+  }
+
+  // Preallocate room for n nodes
+  void reserve(size_t n) { nodes.reserve(n); }
+
+  bool contains(const Key &key) const {
+    Index x = root;
+    while (x != NIL) {
+      if (comp(key, at(x).key))
+        x = left(x);
+      else if (comp(at(x).key, key))
+        x = right(x);
+      else
+        return true;
+    }
+    return false;
+  }
+
+  iterator find(const Key &key) const {
+    iterator it(this);
+    Index x = root;
+    while (x != NIL) {
+      it.path[it.depth++] = x;
+      if (comp(key, at(x).key))
+        x = left(x);
+      else if (comp(at(x).key, key))
+        x = right(x);
+      else
+        return it;
+    }
+    return end();
+  }
+
+  // Return iterator to first element not less than key
+  iterator lower_bound(const Key &key) const {
+    iterator it(this);
+    int best = 0;
+    Index x = root;
+    while (x != NIL) {
+      it.path[it.depth++] = x;
+      if (!comp(at(x).key, key)) {
+        best = it.depth;
+        x = left(x);
+      } else {
+        x = right(x);
+      }
+    }
+    it.depth = best;
+    return it;
+  }
+
+  // Return iterator to first element greater than key
+  iterator upper_bound(const Key &key) const {
+    iterator it(this);
+    int best = 0;
+    Index x = root;
+    while (x != NIL) {
+      it.path[it.depth++] = x;
+      if (comp(key, at(x).key)) {
+        best = it.depth;
+        x = left(x);
+      } else {
+        x = right(x);
+      }
+    }
+    it.depth = best;
+    return it;
+  }
+
+  // Count number of elements in range [l, r] by walking the interval
+  size_t range(const Key &l, const Key &r) const {
+    if (comp(r, l))
+      return 0;
+    size_t cnt = 0;
+    for (auto it = lower_bound(l), end_it = upper_bound(r); it != end_it;
+         ++it)
+      ++cnt;
+    return cnt;
+  }
+
+  iterator begin() const {
+    iterator it(this);
+    it.pushLeftmost(root);
+    return it;
+  }
+
+  iterator end() const { return iterator(this); }
+
+  size_t size() const noexcept { return node_count; }
+};
+
+#endif
@@ -0,0 +1,512 @@
+#ifndef SJTU_ESET_CONCURRENT_HPP
+#define SJTU_ESET_CONCURRENT_HPP
+
+#include "Eset_common.hpp"
+#include "Eset_epoch.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+//  ConcurrentESet: red-black tree set for many readers and few writers.
+//  Readers take no lock: they walk the tree through atomic child links and
+//  validate the walk against a per-tree sequence counter, retrying when a
+//  writer changed the tree underneath them. After a bounded number of
+//  failed attempts a reader falls back to the writer lock, so it cannot
+//  starve. Writers are serialized by one mutex; the counter is only held
+//  odd while links are changed, so the searches of insert and erase do not
+//  disturb readers, and inserting an existing key or erasing a missing one
+//  never takes the lock. Erased nodes are freed through epoch-based
+//  reclamation once no reader can still be looking at them.
+//  Results are returned by value; there are no iterators.
+
+template <class Key, class Compare = DefaultLess<Key>> class ConcurrentESet {
+private:
+  enum Color { RED, BLACK };
+
+  struct Node {
+    const Key key;
+    std::atomic<Node *> left{nullptr};
+    std::atomic<Node *> right{nullptr};
+    std::atomic<size_t> size{1};
+    // Only touched by writers
+    Node *parent;
+    Color color;
+
+    Node(const Key &k, Node *p) : key(k), parent(p), color(RED) {}
+  };
+
+  // Attempts before a reader gives up and takes the writer lock
+  static constexpr int OPTIMISTIC_TRIES = 8;
+  // Polls of an odd version before it counts as a failed attempt
+  static constexpr int WRITER_SPINS = 1024;
+  // A walk longer than this saw a tree in the middle of a rotation
+  static constexpr int MAX_DEPTH = 128;
+  // Retired nodes collected before the first reclamation pass
+  static constexpr size_t RECLAIM_BATCH = 64;
+
+  std::atomic<Node *> root{nullptr};
+  std::atomic<uint64_t> version{0}; // odd while a writer relinks nodes
+  std::atomic<size_t> node_count{0};
+  mutable std::mutex write_lock;
+  std::vector<std::pair<uint64_t, Node *>> retired; // (epoch, node)
+  size_t reclaim_at = RECLAIM_BATCH; // retired.size() that triggers a pass
+  Compare comp;
+
+  static Node *leftOf(const Node *x) {
+    return x->left.load(std::memory_order_acquire);
+  }
+  static Node *rightOf(const Node *x) {
+    return x->right.load(std::memory_order_acquire);
+  }
+  static size_t sizeOf(const Node *x) {
+    return x ? x->size.load(std::memory_order_relaxed) : 0;
+  }
+  // Release stores publish the key of a freshly linked node to readers
+  static void setLeft(Node *x, Node *y) {
+    x->left.store(y, std::memory_order_release);
+  }
+  static void setRight(Node *x, Node *y) {
+    x->right.store(y, std::memory_order_release);
+  }
+  static void setSize(Node *x, size_t s) {
+    x->size.store(s, std::memory_order_relaxed);
+  }
+  static void resize(Node *x) {
+    setSize(x, sizeOf(leftOf(x)) + sizeOf(rightOf(x)) + 1);
+  }
+  static bool isBlack(const Node *x) { return !x || x->color == BLACK; }
+
+  // Run read(valid) without locks until it completes between two equal
+  // even versions; read clears valid when its walk ran away
+  template <class F> auto optimistic(F &&read) const {
+    if (EpochDomain::enter()) {
+      for (int i = 0; i < OPTIMISTIC_TRIES; ++i) {
+        uint64_t v = version.load(std::memory_order_acquire);
+        for (int spin = 0; (v & 1) && spin < WRITER_SPINS; ++spin)
+          v = version.load(std::memory_order_acquire);
+        if (v & 1)
+          continue;
+        bool valid = true;
+        auto result = read(valid);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (valid && version.load(std::memory_order_relaxed) == v) {
+          EpochDomain::exit();
+          return result;
+        }
+      }
+      EpochDomain::exit();
+    }
+    std::lock_guard<std::mutex> guard(write_lock);
+    bool valid = true;
+    return read(valid);
+  }
+
+  // Readers observe the tree only between beginWrite() and endWrite()
+  // pairs, never in the middle of one
+  void beginWrite() {
+    version.store(version.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+  void endWrite() {
+    version.store(version.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_release);
+  }
+
+  // Point whatever referenced x (its parent or the root) at y
+  void replaceChild(Node *x, Node *y) {
+    Node *p = x->parent;
+    if (!p)
+      root.store(y, std::memory_order_release);
+    else if (x == leftOf(p))
+      setLeft(p, y);
+    else
+      setRight(p, y);
+  }
+
+  void leftRotate(Node *x) {
+    Node *y = rightOf(x);
+    setRight(x, leftOf(y));
+    if (leftOf(y))
+      leftOf(y)->parent = x;
+    y->parent = x->parent;
+    replaceChild(x, y);
+    setLeft(y, x);
+    x->parent = y;
+    setSize(y, sizeOf(x));
+    resize(x);
+  }
+
+  void rightRotate(Node *x) {
+    Node *y = leftOf(x);
+    setLeft(x, rightOf(y));
+    if (rightOf(y))
+      rightOf(y)->parent = x;
+    y->parent = x->parent;
+    replaceChild(x, y);
+    setRight(y, x);
+    x->parent = y;
+    setSize(y, sizeOf(x));
+    resize(x);
+  }
+
+  void insertFixup(Node *z) {
+    while (z->parent && z->parent->color == RED) {
+      Node *p = z->parent;
+      Node *g = p->parent;
+      if (p == leftOf(g)) {
+        Node *u = rightOf(g);
+        if (!isBlack(u)) {
+          p->color = u->color = BLACK;
+          g->color = RED;
+          z = g;
+          continue;
+        }
+        if (z == rightOf(p)) {
+          z = p;
+          leftRotate(z);
+          p = z->parent;
+        }
+        p->color = BLACK;
+        g->color = RED;
+        rightRotate(g);
+      } else {
+        Node *u = leftOf(g);
+        if (!isBlack(u)) {
+          p->color = u->color = BLACK;
+          g->color = RED;
+          z = g;
+          continue;
+        }
+        if (z == leftOf(p)) {
+          z = p;
+          rightRotate(z);
+          p = z->parent;
+        }
+        p->color = BLACK;
+        g->color = RED;
+        leftRotate(g);
+      }
+    }
+    root.load(std::memory_order_relaxed)->color = BLACK;
+  }
+
+  void eraseFixup(Node *x, Node *p) {
+    while (x != root.load(std::memory_order_relaxed) && isBlack(x)) {
+      if (x == leftOf(p)) {
+        Node *w = rightOf(p);
+        if (w->color == RED) {
+          w->color = BLACK;
+          p->color = RED;
+          leftRotate(p);
+          w = rightOf(p);
+        }
+        if (isBlack(leftOf(w)) && isBlack(rightOf(w))) {
+          w->color = RED;
+          x = p;
+          p = x->parent;
+        } else {
+          if (isBlack(rightOf(w))) {
+            leftOf(w)->color = BLACK;
+            w->color = RED;
+            rightRotate(w);
+            w = rightOf(p);
+          }
+          w->color = p->color;
+          p->color = BLACK;
+          rightOf(w)->color = BLACK;
+          leftRotate(p);
+          x = root.load(std::memory_order_relaxed);
+        }
+      } else {
+        Node *w = leftOf(p);
+        if (w->color == RED) {
+          w->color = BLACK;
+          p->color = RED;
+          rightRotate(p);
+          w = leftOf(p);
+        }
+        if (isBlack(leftOf(w)) && isBlack(rightOf(w))) {
+          w->color = RED;
+          x = p;
+          p = x->parent;
+        } else {
+          if (isBlack(leftOf(w))) {
+            rightOf(w)->color = BLACK;
+            w->color = RED;
+            leftRotate(w);
+            w = leftOf(p);
+          }
+          w->color = p->color;
+          p->color = BLACK;
+          leftOf(w)->color = BLACK;
+          rightRotate(p);
+          x = root.load(std::memory_order_relaxed);
+        }
+      }
+    }
+    if (x)
+      x->color = BLACK;
+  }
+
+  // Node with key, or nullptr; valid is cleared when the walk runs away
+  Node *search(const Key &key, bool &valid) const {
+    Node *x = root.load(std::memory_order_acquire);
+    for (int depth = 0; x; ++depth) {
+      if (depth == MAX_DEPTH) {
+        valid = false;
+        return nullptr;
+      }
+      if (comp(key, x->key))
+        x = leftOf(x);
+      else if (comp(x->key, key))
+        x = rightOf(x);
+      else
+        return x;
+    }
+    return nullptr;
+  }
+
+  // Key of the first node for which go_left holds, walking from the root
+  template <class GoLeft>
+  std::optional<Key> bound(GoLeft go_left, bool &valid) const {
+    Node *x = root.load(std::memory_order_acquire);
+    Node *res = nullptr;
+    for (int depth = 0; x; ++depth) {
+      if (depth == MAX_DEPTH) {
+        valid = false;
+        return std::nullopt;
+      }
+      if (go_left(x->key)) {
+        res = x;
+        x = leftOf(x);
+      } else {
+        x = rightOf(x);
+      }
+    }
+    if (!res)
+      return std::nullopt;
+    return res->key;
+  }
+
+  // Number of keys k with less(k), which must be monotone over the order
+  template <class Less> size_t countBelow(Less less, bool &valid) const {
+    Node *x = root.load(std::memory_order_acquire);
+    size_t r = 0;
+    for (int depth = 0; x; ++depth) {
+      if (depth == MAX_DEPTH) {
+        valid = false;
+        return 0;
+      }
+      if (less(x->key)) {
+        r += sizeOf(leftOf(x)) + 1;
+        x = rightOf(x);
+      } else {
+        x = leftOf(x);
+      }
+    }
+    return r;
+  }
+
+  // Hand an unlinked node to the reclaimer; called with write_lock held.
+  // The next pass waits until the list has doubled over what this one kept,
+  // so a reader stuck in an old epoch costs O(1) amortized per retire
+  void retire(Node *x) {
+    retired.emplace_back(EpochDomain::instance().current(), x);
+    if (retired.size() < reclaim_at)
+      return;
+    uint64_t oldest = EpochDomain::instance().advance();
+    size_t kept = 0;
+    for (auto &entry : retired) {
+      if (entry.first < oldest)
+        delete entry.second;
+      else
+        retired[kept++] = entry;
+    }
+    retired.resize(kept);
+    reclaim_at = std::max(RECLAIM_BATCH, 2 * kept);
+  }
+
+  static void destroy(Node *x) {
+    if (!x)
+      return;
+    destroy(leftOf(x));
+    destroy(rightOf(x));
+    delete x;
+  }
+
+  // Post-order list of the subtree rooted at x
+  static void collect(Node *x, std::vector<Node *> &out) {
+    if (!x)
+      return;
+    collect(leftOf(x), out);
+    collect(rightOf(x), out);
+    out.push_back(x);
+  }
+
+public:
+  ConcurrentESet() : comp(Compare()) {}
+
+  // Destruction requires that no other thread uses the set
+  ~ConcurrentESet() {
+    destroy(root.load(std::memory_order_relaxed));
+    for (auto &entry : retired)
+      delete entry.second;
+  }
+
+  ConcurrentESet(const ConcurrentESet &) = delete;
+  ConcurrentESet &operator=(const ConcurrentESet &) = delete;
+
+  // Insert key, returns whether it was new
+  bool insert(const Key &key) {
+    if (contains(key))
+      return false;
+    std::lock_guard<std::mutex> guard(write_lock);
+    Node *y = nullptr;
+    Node *x = root.load(std::memory_order_relaxed);
+    while (x) {
+      y = x;
+      if (comp(key, x->key))
+        x = leftOf(x);
+      else if (comp(x->key, key))
+        x = rightOf(x);
+      else
+        return false;
+    }
+    Node *z = new Node(key, y);
+    beginWrite();
+    if (!y)
+      root.store(z, std::memory_order_release);
+    else if (comp(key, y->key))
+      setLeft(y, z);
+    else
+      setRight(y, z);
+    for (Node *p = y; p; p = p->parent)
+      setSize(p, sizeOf(p) + 1);
+    insertFixup(z);
+    endWrite();
+    node_count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Insert element with given arguments, returns whether it was new
+  template <class... Args> bool emplace(Args &&...args) {
+    return insert(Key(std::forward<Args>(args)...));
+  }
+
+  // Erase element by key, returns number of elements erased (0 or 1)
+  size_t erase(const Key &key) {
+    if (!contains(key))
+      return 0;
+    std::lock_guard<std::mutex> guard(write_lock);
+    bool valid = true;
+    Node *z = search(key, valid);
+    if (!z)
+      return 0;
+    beginWrite();
+    // Nodes keep their keys: the successor node is moved into z's place
+    // rather than copying its key, so readers never see a key change
+    Node *y = z;
+    Node *x;
+    Node *x_parent;
+    Color y_color = y->color;
+    Node *p = (leftOf(z) && rightOf(z)) ? rightOf(z) : z->parent;
+    if (leftOf(z) && rightOf(z)) {
+      while (leftOf(p))
+        p = leftOf(p);
+      p = p->parent;
+    }
+    for (; p; p = p->parent)
+      setSize(p, sizeOf(p) - 1);
+    if (!leftOf(z) || !rightOf(z)) {
+      x = leftOf(z) ? leftOf(z) : rightOf(z);
+      x_parent = z->parent;
+      if (x)
+        x->parent = z->parent;
+      replaceChild(z, x);
+    } else {
+      y = rightOf(z);
+      while (leftOf(y))
+        y = leftOf(y);
+      y_color = y->color;
+      x = rightOf(y);
+      if (y->parent == z) {
+        x_parent = y;
+      } else {
+        x_parent = y->parent;
+        if (x)
+          x->parent = y->parent;
+        setLeft(y->parent, x);
+        setRight(y, rightOf(z));
+        rightOf(y)->parent = y;
+      }
+      setLeft(y, leftOf(z));
+      leftOf(y)->parent = y;
+      y->parent = z->parent;
+      y->color = z->color;
+      setSize(y, sizeOf(z));
+      replaceChild(z, y);
+    }
+    if (y_color == BLACK)
+      eraseFixup(x, x_parent);
+    endWrite();
+    node_count.fetch_sub(1, std::memory_order_relaxed);
+    retire(z);
+    return 1;
+  }
+
+  // Remove every element; readers already inside keep a consistent view
+  void clear() {
+    std::lock_guard<std::mutex> guard(write_lock);
+    std::vector<Node *> nodes;
+    collect(root.load(std::memory_order_relaxed), nodes);
+    beginWrite();
+    root.store(nullptr, std::memory_order_release);
+    endWrite();
+    node_count.store(0, std::memory_order_relaxed);
+    for (Node *x : nodes)
+      retire(x);
+  }
+
+  bool contains(const Key &key) const {
+    return optimistic(
+        [&](bool &valid) { return search(key, valid) != nullptr; });
+  }
+
+  // Copy of the first element not less than key, if any
+  std::optional<Key> lower_bound(const Key &key) const {
+    return optimistic([&](bool &valid) {
+      return bound([&](const Key &x) { return !comp(x, key); }, valid);
+    });
+  }
+
+  // Copy of the first element greater than key, if any
+  std::optional<Key> upper_bound(const Key &key) const {
+    return optimistic([&](bool &valid) {
+      return bound([&](const Key &x) { return comp(key, x); }, valid);
+    });
+  }
+
+  // Count number of elements in range [l, r] in O(log n); both bounds are
+  // taken from the same version of the tree
+  size_t range(const Key &l, const Key &r) const {
+    if (comp(r, l))
+      return 0;
+    return optimistic([&](bool &valid) {
+      size_t hi = countBelow([&](const Key &x) { return !comp(r, x); }, valid);
+      size_t lo = countBelow([&](const Key &x) { return comp(x, l); }, valid);
+      return valid && hi >= lo ? hi - lo : 0;
+    });
+  }
+
+  size_t size() const noexcept {
+    return node_count.load(std::memory_order_relaxed);
+  }
+};
+
+#endif
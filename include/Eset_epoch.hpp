@@ -0,0 +1,95 @@
+#ifndef SJTU_ESET_EPOCH_HPP
+#define SJTU_ESET_EPOCH_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//  EpochDomain: process-wide reader registry for epoch-based reclamation.
+//  A reader announces the global epoch it started in; memory retired at
+//  epoch e is freed once every announced epoch is newer than e.
+class EpochDomain {
+public:
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> epoch{0}; // 0 while the owner is not reading
+    std::atomic<bool> used{false};
+  };
+
+private:
+  static constexpr size_t MAX_SLOTS = 256;
+
+  std::atomic<uint64_t> global{1};
+  Slot slots[MAX_SLOTS];
+
+  // Claims a slot for the calling thread on first use, frees it at exit
+  struct Handle {
+    Slot *slot = nullptr;
+    int depth = 0;
+
+    ~Handle() {
+      if (slot)
+        slot->used.store(false, std::memory_order_release);
+    }
+  };
+
+  static Handle &handle() {
+    thread_local Handle h;
+    if (!h.slot)
+      h.slot = instance().claim();
+    return h;
+  }
+
+  Slot *claim() {
+    for (Slot &s : slots) {
+      bool expected = false;
+      if (!s.used.load(std::memory_order_relaxed) &&
+          s.used.compare_exchange_strong(expected, true,
+                                         std::memory_order_acquire))
+        return &s;
+    }
+    return nullptr;
+  }
+
+public:
+  static EpochDomain &instance() {
+    static EpochDomain domain;
+    return domain;
+  }
+
+  uint64_t current() const { return global.load(std::memory_order_acquire); }
+
+  // Start a new epoch and return the oldest one a reader may still be in;
+  // memory retired before it is unreachable for every reader
+  uint64_t advance() {
+    uint64_t next = global.fetch_add(1, std::memory_order_acq_rel) + 1;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t oldest = next;
+    for (Slot &s : slots) {
+      uint64_t e = s.epoch.load(std::memory_order_acquire);
+      if (e && e < oldest)
+        oldest = e;
+    }
+    return oldest;
+  }
+
+  // Announce the current epoch for the calling thread; false when every
+  // slot is taken, in which case the caller must not read optimistically
+  static bool enter() {
+    Handle &h = handle();
+    if (!h.slot)
+      return false;
+    if (h.depth++ == 0) {
+      h.slot->epoch.store(instance().current(), std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+    return true;
+  }
+
+  static void exit() {
+    Handle &h = handle();
+    if (--h.depth == 0)
+      h.slot->epoch.store(0, std::memory_order_release);
+  }
+};
+
+#endif
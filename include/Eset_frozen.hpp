@@ -0,0 +1,227 @@
+#ifndef SJTU_ESET_FROZEN_HPP
+#define SJTU_ESET_FROZEN_HPP
+
+#include "Eset_common.hpp"
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+//  FrozenESet: immutable, read-optimized snapshot produced by ESet::freeze().
+//  Keys are stored in Eytzinger (BFS) order: slot k has its children in
+//  slots 2k and 2k + 1, so a search touches one array and each step is a
+//  branch-free index update. The 16 descendants four levels down share one
+//  cache line for 4-byte keys and are prefetched while the current levels
+//  are compared. Iteration walks the implicit tree and in-order ranks are
+//  computed arithmetically, so range() needs no extra per-key storage.
+
+// Allocator handing out cache-line aligned storage for the key array
+template <class T> struct CacheAlignedAllocator {
+  using value_type = T;
+  static constexpr std::align_val_t ALIGN{64};
+
+  CacheAlignedAllocator() noexcept = default;
+  template <class U>
+  CacheAlignedAllocator(const CacheAlignedAllocator<U> &) noexcept {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(::operator new(n * sizeof(T), ALIGN));
+  }
+  void deallocate(T *p, size_t) noexcept { ::operator delete(p, ALIGN); }
+
+  bool operator==(const CacheAlignedAllocator &) const noexcept {
+    return true;
+  }
+  bool operator!=(const CacheAlignedAllocator &) const noexcept {
+    return false;
+  }
+};
+
+template <class Key, class Compare = DefaultLess<Key>> class FrozenESet {
+private:
+  // keys[1..n] hold the tree; keys[0] is a filler copy so that slot k sits
+  // at offset k and sibling blocks line up with cache lines
+  std::vector<Key, CacheAlignedAllocator<Key>> keys;
+  size_t n;
+  int height; // depth of the deepest level, -1 when empty
+  Compare comp;
+
+  static int log2Floor(size_t x) { return 63 - __builtin_clzll(x); }
+
+  // Place sorted[i..] into the subtree rooted at slot k, in order
+  void fill(const std::vector<Key> &sorted, size_t &i, size_t k) {
+    if (k > n)
+      return;
+    fill(sorted, i, 2 * k);
+    keys[k] = sorted[i++];
+    fill(sorted, i, 2 * k + 1);
+  }
+
+  __attribute__((always_inline)) inline void prefetch(size_t k) const {
+    // Four levels below k: slots 16k .. 16k + 15
+    if (16 * k <= n)
+      __builtin_prefetch(keys.data() + 16 * k);
+  }
+
+  // Slot of the first key for which go_right is false, 0 if there is none.
+  // Walking right appends a 1 bit to k and walking left a 0 bit, so the
+  // answer is k with its trailing 1 bits and the last 0 bit shifted off.
+  template <class GoRight>
+  __attribute__((always_inline)) inline size_t
+  descend(GoRight go_right) const {
+    size_t k = 1;
+    while (k <= n) {
+      prefetch(k);
+      k = 2 * k + static_cast<size_t>(go_right(keys[k]));
+    }
+    return k >> __builtin_ffsll(static_cast<long long>(~k));
+  }
+
+public:
+  // Bidirectional iterator over the implicit tree, in key order
+  class const_iterator {
+    friend class FrozenESet;
+
+  private:
+    const FrozenESet *set;
+    size_t k; // slot, 0 means end()
+
+    const_iterator(const FrozenESet *s, size_t slot) : set(s), k(slot) {}
+
+  public:
+    const_iterator() : set(nullptr), k(0) {}
+
+    const Key &operator*() const {
+      if (!k)
+        throw std::out_of_range("dereferencing end iterator");
+      return set->keys[k];
+    }
+
+    const_iterator &operator++() {
+      if (!k)
+        return *this;
+      size_t n = set->n;
+      if (2 * k + 1 <= n) {
+        k = 2 * k + 1;
+        while (2 * k <= n)
+          k = 2 * k;
+      } else {
+        while (k & 1)
+          k >>= 1;
+        k >>= 1;
+      }
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+
+    const_iterator &operator--() {
+      size_t n = set ? set->n : 0;
+      if (!k) {
+        if (!n)
+          return *this;
+        k = 1;
+        while (2 * k + 1 <= n)
+          k = 2 * k + 1;
+      } else if (2 * k <= n) {
+        k = 2 * k;
+        while (2 * k + 1 <= n)
+          k = 2 * k + 1;
+      } else {
+        size_t x = k;
+        while (x > 1 && !(x & 1))
+          x >>= 1;
+        // Already at the first element: stay put, like ESet
+        if (x > 1)
+          k = x >> 1;
+      }
+      return *this;
+    }
+
+    const_iterator operator--(int) {
+      const_iterator tmp = *this;
+      --(*this);
+      return tmp;
+    }
+
+    bool operator==(const const_iterator &rhs) const { return k == rhs.k; }
+    bool operator!=(const const_iterator &rhs) const { return k != rhs.k; }
+  };
+
+  using iterator = const_iterator;
+
+  FrozenESet() : n(0), height(-1), comp(Compare()) {}
+
+  // Build from strictly increasing keys
+  FrozenESet(const std::vector<Key> &sorted, const Compare &c = Compare())
+      : n(sorted.size()),
+        height(sorted.empty() ? -1 : log2Floor(sorted.size())), comp(c) {
+    if (!n)
+      return;
+    keys.assign(n + 1, sorted[0]);
+    size_t i = 0;
+    fill(sorted, i, 1);
+  }
+
+  // In-order position of slot k (n for end()). In a perfect tree of the
+  // same height the rank follows from k's level and offset; the missing
+  // slots on the last level that would come before k are then subtracted.
+  size_t rankOf(size_t k) const {
+    if (!k)
+      return n;
+    int d = log2Floor(k);
+    size_t perfect = ((2 * (k - (size_t(1) << d)) + 1) << (height - d)) - 1;
+    size_t last_level = n - (size_t(1) << height) + 1;
+    size_t before = (perfect + 1) / 2;
+    return perfect - (before > last_level ? before - last_level : 0);
+  }
+
+  // Return iterator to first element not less than key
+  __attribute__((always_inline)) inline iterator
+  lower_bound(const Key &key) const {
+    return iterator(this, descend([&](const Key &x) { return comp(x, key); }));
+  }
+
+  // Return iterator to first element greater than key
+  __attribute__((always_inline)) inline iterator
+  upper_bound(const Key &key) const {
+    return iterator(this,
+                    descend([&](const Key &x) { return !comp(key, x); }));
+  }
+
+  __attribute__((always_inline)) inline iterator find(const Key &key) const {
+    size_t k = descend([&](const Key &x) { return comp(x, key); });
+    return iterator(this, k && !comp(key, keys[k]) ? k : 0);
+  }
+
+  __attribute__((always_inline)) inline bool contains(const Key &key) const {
+    return find(key) != end();
+  }
+
+  // Count number of elements in range [l, r] in O(log n)
+  size_t range(const Key &l, const Key &r) const {
+    if (comp(r, l))
+      return 0;
+    return rankOf(upper_bound(r).k) - rankOf(lower_bound(l).k);
+  }
+
+  iterator begin() const {
+    if (!n)
+      return end();
+    size_t k = 1;
+    while (2 * k <= n)
+      k = 2 * k;
+    return iterator(this, k);
+  }
+
+  iterator end() const { return iterator(this, 0); }
+
+  size_t size() const noexcept { return n; }
+};
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef SJTU_ESET_PARALLEL_HPP
+#define SJTU_ESET_PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//  Fork-join helpers used by the bulk ESet operations.
+//  Work is split recursively and the halves are handed to a process-wide
+//  work-stealing pool; depth bounds how many times a task may fork.
+
+// Below this many elements a task is cheaper to run inline
+constexpr size_t PARALLEL_GRAIN = 1 << 15;
+
+//  WorkStealingPool: one deque of pending tasks per worker plus one shared
+//  deque for threads outside the pool. Owners push and pop at the back, idle
+//  workers steal from the front of the others, and a thread waiting for a
+//  forked task runs other pending tasks instead of blocking.
+class WorkStealingPool {
+public:
+  struct Task {
+    std::atomic<bool> done{false};
+    virtual void run() noexcept = 0;
+
+  protected:
+    ~Task() = default;
+  };
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<Task *> tasks;
+  };
+
+  std::vector<std::thread> workers;
+  std::unique_ptr<Queue[]> queues; // one per worker, the last one is shared
+  size_t queue_count;
+  std::atomic<size_t> pending;
+  bool stopping;
+  std::mutex sleep_lock;
+  std::condition_variable wake;
+
+  static size_t &workerIndex() {
+    thread_local size_t index = static_cast<size_t>(-1);
+    return index;
+  }
+
+  // Queue the calling thread pushes to
+  Queue &home() {
+    size_t i = workerIndex();
+    return queues[i < queue_count - 1 ? i : queue_count - 1];
+  }
+
+  Task *popBack(Queue &q) {
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.tasks.empty())
+      return nullptr;
+    Task *t = q.tasks.back();
+    q.tasks.pop_back();
+    pending.fetch_sub(1, std::memory_order_relaxed);
+    return t;
+  }
+
+  Task *stealFront(Queue &q) {
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.tasks.empty())
+      return nullptr;
+    Task *t = q.tasks.front();
+    q.tasks.pop_front();
+    pending.fetch_sub(1, std::memory_order_relaxed);
+    return t;
+  }
+
+  // Own queue first, then every other queue starting after our own
+  Task *findWork() {
+    if (Task *t = popBack(home()))
+      return t;
+    size_t start = workerIndex() + 1;
+    for (size_t k = 0; k < queue_count; ++k)
+      if (Task *t = stealFront(queues[(start + k) % queue_count]))
+        return t;
+    return nullptr;
+  }
+
+  void workerLoop(size_t index) {
+    workerIndex() = index;
+    while (true) {
+      if (Task *t = findWork()) {
+        t->run();
+        continue;
+      }
+      std::unique_lock<std::mutex> guard(sleep_lock);
+      wake.wait(guard, [&] {
+        return stopping || pending.load(std::memory_order_relaxed) > 0;
+      });
+      if (stopping)
+        return;
+    }
+  }
+
+public:
+  explicit WorkStealingPool(size_t threads)
+      : queues(new Queue[threads + 1]), queue_count(threads + 1), pending(0),
+        stopping(false) {
+    workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+      workers.emplace_back([this, i] { workerLoop(i); });
+  }
+
+  ~WorkStealingPool() {
+    {
+      std::lock_guard<std::mutex> guard(sleep_lock);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &w : workers)
+      w.join();
+  }
+
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+  // Shared pool with one worker per hardware thread besides the caller
+  static WorkStealingPool &instance() {
+    static WorkStealingPool pool(std::thread::hardware_concurrency() > 1
+                                     ? std::thread::hardware_concurrency() - 1
+                                     : 0);
+    return pool;
+  }
+
+  // Number of threads that can run tasks, counting the caller
+  size_t concurrency() const { return workers.size() + 1; }
+
+  // Make t available to other threads; it must outlive join(t)
+  void submit(Task *t) {
+    Queue &q = home();
+    {
+      std::lock_guard<std::mutex> guard(q.lock);
+      q.tasks.push_back(t);
+    }
+    pending.fetch_add(1, std::memory_order_relaxed);
+    // Taking the lock orders this wake-up after any sleeper's last check
+    { std::lock_guard<std::mutex> guard(sleep_lock); }
+    wake.notify_one();
+  }
+
+  // Wait until t has run, helping with pending tasks in the meantime
+  void join(Task *t) {
+    while (!t->done.load(std::memory_order_acquire)) {
+      if (Task *other = findWork())
+        other->run();
+      else
+        std::this_thread::yield();
+    }
+  }
+};
+
+template <class F> struct InvokeTask final : WorkStealingPool::Task {
+  F &fn;
+  std::exception_ptr error;
+
+  explicit InvokeTask(F &f) : fn(f) {}
+
+  void run() noexcept override {
+    try {
+      fn();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    done.store(true, std::memory_order_release);
+  }
+};
+
+// Number of fork levels worth taking: enough to give every pool thread a
+// task, plus two so stealing can even out unbalanced halves
+inline size_t parallelDepth() {
+  size_t threads = WorkStealingPool::instance().concurrency();
+  if (threads <= 1)
+    return 0;
+  size_t depth = 2;
+  while ((size_t(1) << (depth - 2)) < threads)
+    ++depth;
+  return depth;
+}
+
+// Run f and g, letting another pool thread pick up f while depth > 0
+template <class F, class G> void parallelInvoke(F &&f, G &&g, size_t depth) {
+  WorkStealingPool &pool = WorkStealingPool::instance();
+  if (depth == 0 || pool.concurrency() <= 1) {
+    f();
+    g();
+    return;
+  }
+  InvokeTask<std::remove_reference_t<F>> task(f);
+  pool.submit(&task);
+  try {
+    g();
+  } catch (...) {
+    pool.join(&task);
+    throw;
+  }
+  pool.join(&task);
+  if (task.error)
+    std::rethrow_exception(task.error);
+}
+
+// Sort [first, last) by comp: halves are sorted on separate threads and
+// merged on the way back up
+template <class RandomIt, class Compare>
+void parallelSort(RandomIt first, RandomIt last, Compare comp,
+                  size_t depth = parallelDepth()) {
+  size_t n = static_cast<size_t>(last - first);
+  if (depth == 0 || n < PARALLEL_GRAIN) {
+    std::sort(first, last, comp);
+    return;
+  }
+  RandomIt mid = first + n / 2;
+  parallelInvoke([&] { parallelSort(first, mid, comp, depth - 1); },
+                 [&] { parallelSort(mid, last, comp, depth - 1); }, depth);
+  std::inplace_merge(first, mid, last, comp);
+}
+
+// Drop adjacent equivalent elements of the sorted range [first, last) and
+// return the new end. Chunks are deduplicated in parallel, then compacted.
+template <class RandomIt, class Compare>
+RandomIt parallelUnique(RandomIt first, RandomIt last, Compare comp,
+                        size_t depth = parallelDepth()) {
+  auto equiv = [&](const auto &a, const auto &b) { return !comp(a, b); };
+  size_t n = static_cast<size_t>(last - first);
+  size_t chunks = size_t(1) << depth;
+  if (depth == 0 || n < PARALLEL_GRAIN * 2)
+    return std::unique(first, last, equiv);
+  if (chunks > n / PARALLEL_GRAIN)
+    chunks = n / PARALLEL_GRAIN;
+
+  std::vector<RandomIt> begins(chunks + 1), ends(chunks);
+  std::vector<char> keep_first(chunks);
+  for (size_t c = 0; c <= chunks; ++c)
+    begins[c] = first + n * c / chunks;
+  // Chunk borders are decided before any chunk starts overwriting itself
+  for (size_t c = 0; c < chunks; ++c)
+    keep_first[c] = c == 0 || comp(*(begins[c] - 1), *begins[c]);
+
+  auto work = [&](auto &self, size_t lo, size_t hi, size_t d) -> void {
+    if (hi - lo == 1) {
+      ends[lo] = std::unique(begins[lo], begins[lo + 1], equiv);
+      return;
+    }
+    size_t mid = (lo + hi) / 2;
+    parallelInvoke([&] { self(self, lo, mid, d ? d - 1 : 0); },
+                   [&] { self(self, mid, hi, d ? d - 1 : 0); }, d);
+  };
+  work(work, 0, chunks, depth);
+
+  RandomIt out = first;
+  for (size_t c = 0; c < chunks; ++c) {
+    RandomIt b = begins[c] + (keep_first[c] ? 0 : 1);
+    out = b == out ? ends[c] : std::move(b, ends[c], out);
+  }
+  return out;
+}
+
+#endif
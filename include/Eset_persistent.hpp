@@ -1,275 +1,617 @@
-#ifndef SJTU_ESET_HPP
-#define SJTU_ESET_HPP
+#ifndef SJTU_ESET_PERSISTENT_HPP
+#define SJTU_ESET_PERSISTENT_HPP
 
+// This header defines its own ESet, so it can't share a unit with Eset.hpp
+#ifdef SJTU_ESET_HPP
+#error "Eset_persistent.hpp and Eset.hpp both define ESet; include only one"
+#endif
+
+#include "Eset_common.hpp"
+#include "Eset_epoch.hpp"
+#include "Eset_pool.hpp"
 #include <algorithm>
-#include <functional>
-#include <memory>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <stdexcept>
+#include <thread>
+#include <tuple>
 #include <utility>
 
-template <typename T> struct DefaultLess {
-  bool operator()(const T &a, const T &b) const { return a < b; }
+//  Persistent ESet: every emplace/erase builds a new version by path copying
+//  and leaves older versions untouched, so copies are O(1) snapshots.
+//  The current version is published through an atomic pointer: any number
+//  of threads may read and write the same ESet without locks. Readers grab
+//  a version in a few atomic steps (snapshot()), writers build their new
+//  version off to the side and commit it with compare-and-swap, redoing
+//  the update on top of the winner when another writer got there first.
+//  Replaced versions are released through epoch-based reclamation.
+//  Versions are balanced red-black trees (Okasaki's insert, Kahrs' erase),
+//  so every operation copies and visits O(log n) nodes.
+//  Nodes are pooled and carry an intrusive reference count. The count is a
+//  plain integer by default (LocalRefCount): sets and their snapshots may
+//  then only be used from one thread at a time. Sharing one set between
+//  threads as described above needs ESet<Key, Compare, SharedRefCount>.
+//  Lookups walk raw pointers without touching counts, and iterators keep
+//  their root-to-node path, so ++/-- are amortized O(1) in any version.
+//  Updates change a node in place when they hold its only reference and
+//  copy it otherwise. A published update holds an extra reference to the
+//  root it starts from, so it copies the whole search path; a transient()
+//  owns the nodes it made and copies only what it shares with a version.
+
+// Reference count policies for persistent nodes
+struct LocalRefCount {
+  uint32_t n = 1;
+
+  void acquire() noexcept { ++n; }
+  // True when the last reference was dropped
+  bool release() noexcept { return --n == 0; }
+  bool unique() const noexcept { return n == 1; }
+};
+
+struct SharedRefCount {
+  std::atomic<uint32_t> n{1};
+
+  void acquire() noexcept { n.fetch_add(1, std::memory_order_relaxed); }
+  bool release() noexcept {
+    return n.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+  bool unique() const noexcept {
+    return n.load(std::memory_order_acquire) == 1;
+  }
 };
 
-template <class Key, class Compare = DefaultLess<Key>> class ESet {
+template <class Key, class Compare = DefaultLess<Key>,
+          class RefCount = LocalRefCount>
+class ESet {
 private:
-  enum Color { RED, BLACK };
+  enum Color : unsigned char { RED, BLACK };
 
-  // Node structure for persistent red-black tree
+  // Node of the persistent red-black tree; immutable once reachable from a
+  // published version. Each child pointer owns one reference.
   struct Node {
     Key key;
-    std::shared_ptr<Node> left;
-    std::shared_ptr<Node> right;
-    std::weak_ptr<Node> parent; // 添加父指针
+    Node *left;
+    Node *right;
+    RefCount refs;
     Color color;
-    size_t ref_count;
 
-    Node(const Key &k, std::shared_ptr<Node> l = nullptr,
-         std::shared_ptr<Node> r = nullptr, Color c = RED)
-        : key(k), left(l), right(r), color(c), ref_count(1) {}
+    Node(const Key &k, Node *l, Node *r, Color c)
+        : key(k), left(l), right(r), color(c) {}
   };
 
-  using NodePtr = std::shared_ptr<Node>;
+  using Pool = ESetSharedPool<Node>;
 
-  // Persistent Red-Black Tree implementation
-  class RBTree {
+  static void release(Node *x) noexcept {
+    if (x && x->refs.release()) {
+      release(x->left);
+      release(x->right);
+      x->~Node();
+      Pool::deallocate(x);
+    }
+  }
+
+  // Owning reference to a node
+  class NodePtr {
   private:
-    NodePtr root;
-    size_t node_count;
+    Node *p;
 
   public:
-    Compare comp;
+    NodePtr(std::nullptr_t = nullptr) noexcept : p(nullptr) {}
+    // Take over a reference the caller already holds
+    explicit NodePtr(Node *x) noexcept : p(x) {}
+    NodePtr(const NodePtr &other) noexcept : p(other.p) {
+      if (p)
+        p->refs.acquire();
+    }
+    NodePtr(NodePtr &&other) noexcept : p(other.p) { other.p = nullptr; }
+    NodePtr &operator=(NodePtr other) noexcept {
+      std::swap(p, other.p);
+      return *this;
+    }
+    ~NodePtr() { ESet::release(p); }
 
-  private:
-    // Helper function to create a new node with shared_ptr
-    static NodePtr make_node(const Key &key, NodePtr left = nullptr,
-                             NodePtr right = nullptr, Color color = RED) {
-      NodePtr node = std::make_shared<Node>(key, left, right, color);
-      if (left)
-        left->parent = node;
-      if (right)
-        right->parent = node;
-      return node;
-    }
-
-    // Persistent insert implementation
-    NodePtr insert(NodePtr x, const Key &key, bool &inserted) const {
-      if (!x) {
-        inserted = true;
-        return make_node(key, nullptr, nullptr, RED);
-      }
+    Node *get() const noexcept { return p; }
+    Node *operator->() const noexcept { return p; }
+    explicit operator bool() const noexcept { return p; }
 
-      if (comp(key, x->key)) {
-        NodePtr new_left = insert(x->left, key, inserted);
-        if (inserted) {
-          // Only create new nodes if insertion actually happened
-          return make_node(x->key, new_left, x->right, x->color);
-        }
-        return x;
-      } else if (comp(x->key, key)) {
-        NodePtr new_right = insert(x->right, key, inserted);
-        if (inserted) {
-          return make_node(x->key, x->left, new_right, x->color);
-        }
-        return x;
-      } else {
-        inserted = false;
-        return x;
-      }
+    // Hand the reference over to the caller
+    Node *detach() noexcept { return std::exchange(p, nullptr); }
+  };
+
+  // New reference to a node that stays owned elsewhere
+  static NodePtr share(Node *x) noexcept {
+    if (x)
+      x->refs.acquire();
+    return NodePtr(x);
+  }
+
+  // Node algorithms. Each takes and returns owning references and edits a
+  // node in place when it holds the only reference (own()).
+
+  // New node owning the references in left and right
+  static NodePtr make_node(const Key &key, NodePtr left, NodePtr right,
+                           Color color) {
+    Node *x = Pool::allocate();
+    try {
+      new (x) Node(key, left.get(), right.get(), color);
+    } catch (...) {
+      Pool::deallocate(x);
+      throw;
     }
+    left.detach();
+    right.detach();
+    return NodePtr(x);
+  }
 
-    // Persistent erase implementation
-    NodePtr erase(NodePtr x, const Key &key, bool &erased) const {
-      if (!x) {
-        erased = false;
-        return x;
+  // x itself if no one else refers to it, a private copy otherwise
+  static NodePtr own(NodePtr x) {
+    if (x->refs.unique())
+      return x;
+    return make_node(x->key, share(x->left), share(x->right), x->color);
+  }
+
+  // Move a child reference out of its slot
+  static NodePtr take(Node *&slot) noexcept {
+    return NodePtr(std::exchange(slot, nullptr));
+  }
+
+  static bool isRed(const Node *x) { return x && x->color == RED; }
+  static bool isBlack(const Node *x) { return x && x->color == BLACK; }
+
+  static NodePtr paint(NodePtr x, Color c) {
+    if (!x || x->color == c)
+      return x;
+    x = own(std::move(x));
+    x->color = c;
+    return x;
+  }
+
+  // x -> its right child, which must be red, rotated above it
+  static NodePtr rotateLeft(NodePtr x) {
+    NodePtr r = own(take(x->right));
+    x->right = r->left;
+    r->left = x.detach();
+    return r;
+  }
+
+  static NodePtr rotateRight(NodePtr x) {
+    NodePtr l = own(take(x->left));
+    x->left = l->right;
+    l->right = x.detach();
+    return l;
+  }
+
+  // Make the owned node x black, repairing a red child that has a red
+  // child of its own by turning the three into a red node with two black
+  // children
+  static NodePtr balance(NodePtr x) {
+    if (isRed(x->left) && isRed(x->right)) {
+      x->left = paint(take(x->left), BLACK).detach();
+      x->right = paint(take(x->right), BLACK).detach();
+      x->color = RED;
+      return x;
+    }
+    x->color = BLACK;
+    if (isRed(x->left) && (isRed(x->left->left) || isRed(x->left->right))) {
+      NodePtr l = own(take(x->left));
+      if (isRed(l->right))
+        l = rotateLeft(std::move(l));
+      l->left = paint(take(l->left), BLACK).detach();
+      x->left = std::exchange(l->right, nullptr);
+      l->right = x.detach();
+      return l;
+    }
+    if (isRed(x->right) &&
+        (isRed(x->right->right) || isRed(x->right->left))) {
+      NodePtr r = own(take(x->right));
+      if (isRed(r->left))
+        r = rotateRight(std::move(r));
+      r->right = paint(take(r->right), BLACK).detach();
+      x->right = std::exchange(r->left, nullptr);
+      r->left = x.detach();
+      return r;
+    }
+    return x;
+  }
+
+  // Owned node x after its left subtree lost one unit of black height
+  static NodePtr balanceLeft(NodePtr x) {
+    if (isRed(x->left)) {
+      x->left = paint(take(x->left), BLACK).detach();
+      x->color = RED;
+      return x;
+    }
+    if (isBlack(x->right)) {
+      x->right = paint(take(x->right), RED).detach();
+      return balance(std::move(x));
+    }
+    // Right child is red with a black left child rl: rl goes on top with
+    // x and the rebalanced right child below it
+    NodePtr r = own(take(x->right));
+    NodePtr rl = own(take(r->left));
+    x->right = std::exchange(rl->left, nullptr);
+    x->color = BLACK;
+    r->left = std::exchange(rl->right, nullptr);
+    r->right = paint(take(r->right), RED).detach();
+    rl->left = x.detach();
+    rl->right = balance(std::move(r)).detach();
+    rl->color = RED;
+    return rl;
+  }
+
+  // Owned node x after its right subtree lost one unit of black height
+  static NodePtr balanceRight(NodePtr x) {
+    if (isRed(x->right)) {
+      x->right = paint(take(x->right), BLACK).detach();
+      x->color = RED;
+      return x;
+    }
+    if (isBlack(x->left)) {
+      x->left = paint(take(x->left), RED).detach();
+      return balance(std::move(x));
+    }
+    NodePtr l = own(take(x->left));
+    NodePtr lr = own(take(l->right));
+    x->left = std::exchange(lr->right, nullptr);
+    x->color = BLACK;
+    l->right = std::exchange(lr->left, nullptr);
+    l->left = paint(take(l->left), RED).detach();
+    lr->right = x.detach();
+    lr->left = balance(std::move(l)).detach();
+    lr->color = RED;
+    return lr;
+  }
+
+  // Join two subtrees of equal black height whose keys are all ordered
+  // l before r; the result may have a red root
+  static NodePtr fuse(NodePtr l, NodePtr r) {
+    if (!l)
+      return r;
+    if (!r)
+      return l;
+    if (isRed(l.get()) != isRed(r.get())) {
+      if (isRed(r.get())) {
+        r = own(std::move(r));
+        r->left = fuse(std::move(l), take(r->left)).detach();
+        return r;
       }
+      l = own(std::move(l));
+      l->right = fuse(take(l->right), std::move(r)).detach();
+      return l;
+    }
+    // Same colour: fuse the inner subtrees, then lift a red result
+    // between l and r, or hang it below r
+    l = own(std::move(l));
+    r = own(std::move(r));
+    NodePtr m = fuse(take(l->right), take(r->left));
+    if (isRed(m.get())) {
+      m = own(std::move(m));
+      l->right = std::exchange(m->left, l.get());
+      r->left = std::exchange(m->right, r.get());
+      l.detach();
+      r.detach();
+      return m;
+    }
+    r->left = m.detach();
+    l->right = r.detach();
+    if (l->color == RED)
+      return l;
+    return balanceLeft(std::move(l));
+  }
+
+  // Okasaki's insert: rebalance each black node on the way back up; the
+  // root may come back red. When key is already present the result holds
+  // the same keys, possibly in fresh copies of the search path.
+  static NodePtr insertNode(NodePtr x, const Key &key, const Compare &comp,
+                            bool &inserted) {
+    if (!x) {
+      inserted = true;
+      return make_node(key, nullptr, nullptr, RED);
+    }
+    x = own(std::move(x));
+    if (comp(key, x->key))
+      x->left = insertNode(take(x->left), key, comp, inserted).detach();
+    else if (comp(x->key, key))
+      x->right = insertNode(take(x->right), key, comp, inserted).detach();
+    else
+      inserted = false;
+    if (!inserted || x->color == RED)
+      return x;
+    return balance(std::move(x));
+  }
 
+  // Kahrs' erase of a key known to be present. Leaving a black child
+  // shrinks its black height by one, which balanceLeft/balanceRight absorb
+  // on the way back up.
+  static NodePtr eraseNode(NodePtr x, const Key &key, const Compare &comp) {
+    if (!comp(key, x->key) && !comp(x->key, key)) {
+      if (x->refs.unique())
+        return fuse(take(x->left), take(x->right));
+      return fuse(share(x->left), share(x->right));
+    }
+    x = own(std::move(x));
+    if (comp(key, x->key)) {
+      bool shrinks = isBlack(x->left);
+      x->left = eraseNode(take(x->left), key, comp).detach();
+      if (shrinks)
+        return balanceLeft(std::move(x));
+    } else {
+      bool shrinks = isBlack(x->right);
+      x->right = eraseNode(take(x->right), key, comp).detach();
+      if (shrinks)
+        return balanceRight(std::move(x));
+    }
+    x->color = RED;
+    return x;
+  }
+
+  static const Node *findNode(const Node *x, const Key &key,
+                              const Compare &comp) {
+    while (x) {
       if (comp(key, x->key)) {
-        NodePtr new_left = erase(x->left, key, erased);
-        if (erased) {
-          return make_node(x->key, new_left, x->right, x->color);
-        }
-        return x;
+        x = x->left;
       } else if (comp(x->key, key)) {
-        NodePtr new_right = erase(x->right, key, erased);
-        if (erased) {
-          return make_node(x->key, x->left, new_right, x->color);
-        }
-        return x;
+        x = x->right;
       } else {
-        erased = true;
-        if (!x->left) {
-          return x->right;
-        } else if (!x->right) {
-          return x->left;
-        } else {
-          // Node has two children, find successor
-          NodePtr successor = x->right;
-          while (successor->left) {
-            successor = successor->left;
-          }
-          // Remove successor (which is guaranteed to have at most one child)
-          bool dummy;
-          NodePtr new_right = erase(x->right, successor->key, dummy);
-          return make_node(successor->key, x->left, new_right, x->color);
-        }
+        return x;
       }
     }
+    return nullptr;
+  }
+
+  // Persistent Red-Black Tree implementation
+  class RBTree {
+  private:
+    // One published version; immutable once visible to other threads
+    struct Version {
+      NodePtr root;
+      size_t count;
+      uint64_t retired_at = 0;
+      Version *next_retired = nullptr;
+    };
+
+    // Replaced versions collected before a reclamation pass
+    static constexpr size_t RECLAIM_BATCH = 64;
+
+    std::atomic<Version *> current;
+    std::atomic<Version *> retired{nullptr}; // stack of replaced versions
+    std::atomic<size_t> retired_count{0};
 
   public:
-    RBTree() : root(nullptr), node_count(0), comp(Compare()) {}
-    RBTree(NodePtr r, size_t cnt, Compare c)
-        : root(r), node_count(cnt), comp(c) {}
-
-    // Copy is trivial due to shared_ptr
-    RBTree(const RBTree &other) = default;
-    RBTree &operator=(const RBTree &other) = default;
-
-    // Move is trivial due to shared_ptr
-    RBTree(RBTree &&other) noexcept = default;
-    RBTree &operator=(RBTree &&other) noexcept = default;
-    NodePtr predecessor(NodePtr x) const {
-      if (x->left)
-        return maximum(x->left);
-      NodePtr y = x->parent.lock();
-      while (y && x == y->left) {
-        x = y;
-        y = y->parent.lock();
+    Compare comp;
+
+  private:
+    // Pin the current epoch so no version read meanwhile is freed; threads
+    // beyond the slot limit wait for a slot to come free
+    struct EpochPin {
+      EpochPin() {
+        while (!EpochDomain::enter())
+          std::this_thread::yield();
       }
-      return y;
+      ~EpochPin() { EpochDomain::exit(); }
+    };
+
+    // Push v onto the retired stack and free what no reader can still use
+    void retire(Version *v) {
+      v->retired_at = EpochDomain::instance().current();
+      v->next_retired = retired.load(std::memory_order_relaxed);
+      while (!retired.compare_exchange_weak(v->next_retired, v,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed))
+        ;
+      if (retired_count.fetch_add(1, std::memory_order_relaxed) %
+              RECLAIM_BATCH ==
+          RECLAIM_BATCH - 1)
+        reclaim();
     }
 
-    NodePtr successor(NodePtr x) const {
-      if (x->right)
-        return minimum(x->right);
-      NodePtr y = x->parent.lock();
-      while (y && x == y->right) {
-        x = y;
-        y = y->parent.lock();
+    void reclaim() {
+      Version *list = retired.exchange(nullptr, std::memory_order_acquire);
+      uint64_t oldest = EpochDomain::instance().advance();
+      while (list) {
+        Version *next = list->next_retired;
+        if (list->retired_at < oldest) {
+          delete list;
+        } else {
+          list->next_retired = retired.load(std::memory_order_relaxed);
+          while (!retired.compare_exchange_weak(list->next_retired, list,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed))
+            ;
+        }
+        list = next;
       }
-      return y;
     }
 
-    // Find minimum node in subtree
-    NodePtr minimum(NodePtr x) const {
-      while (x && x->left) {
-        x = x->left;
+    // Apply step(root, count) -> {new_root, new_count, changed} to the
+    // current version and publish the result, retrying from the newer
+    // version if another writer committed first. Returns the committed
+    // root, or the unchanged one when step made no change.
+    template <class Step> std::pair<NodePtr, bool> commit(Step step) {
+      EpochPin pin;
+      Version *cur = current.load(std::memory_order_acquire);
+      while (true) {
+        auto [new_root, new_count, changed] =
+            step(cur->root.get(), cur->count);
+        if (!changed)
+          return {cur->root, false};
+        NodePtr result = new_root;
+        Version *next = new Version{std::move(new_root), new_count};
+        // cur cannot be freed and reused while we are pinned, so a
+        // successful exchange really replaced the version we built on
+        if (current.compare_exchange_strong(cur, next,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+          retire(cur);
+          return {std::move(result), true};
+        }
+        delete next;
       }
-      return x;
     }
 
-    // Find maximum node in subtree
-    NodePtr maximum(NodePtr x) const {
-      while (x && x->right) {
-        x = x->right;
+  public:
+    RBTree() : current(new Version{nullptr, 0}), comp(Compare()) {}
+    RBTree(NodePtr r, size_t cnt, Compare c)
+        : current(new Version{std::move(r), cnt}), comp(c) {}
+
+    // Copies take a snapshot of other's current version
+    RBTree(const RBTree &other)
+        : current(new Version(other.snapshot())), comp(other.comp) {}
+    RBTree &operator=(const RBTree &other) {
+      if (this != &other) {
+        Version snap = other.snapshot();
+        commit([&](const Node *, size_t) {
+          return std::tuple<NodePtr, size_t, bool>(snap.root, snap.count,
+                                                   true);
+        });
+        comp = other.comp;
       }
-      return x;
+      return *this;
     }
 
-    // Find node with given key
-    NodePtr find(NodePtr x, const Key &key) const {
-      while (x) {
-        if (comp(key, x->key)) {
-          x = x->left;
-        } else if (comp(x->key, key)) {
-          x = x->right;
-        } else {
-          return x;
-        }
+    // Moves take other's current version and leave it an empty one, which
+    // is allocated first so a failed allocation changes nothing. Like
+    // destruction they require that no other thread uses either tree
+    RBTree(RBTree &&other)
+        : current(other.current.exchange(new Version{nullptr, 0},
+                                         std::memory_order_relaxed)),
+          comp(other.comp) {}
+    RBTree &operator=(RBTree &&other) {
+      if (this != &other) {
+        Version *empty = new Version{nullptr, 0};
+        delete current.exchange(
+            other.current.exchange(empty, std::memory_order_relaxed),
+            std::memory_order_relaxed);
+        comp = other.comp;
       }
-      return nullptr;
+      return *this;
     }
 
-    // Lower bound implementation
-    NodePtr lower_bound(NodePtr x, const Key &key) const {
-      NodePtr result = nullptr;
-      while (x) {
-        if (!comp(x->key, key)) {
-          result = x;
-          x = x->left;
-        } else {
-          x = x->right;
-        }
+    // Destruction requires that no other thread still uses the tree
+    ~RBTree() {
+      delete current.load(std::memory_order_relaxed);
+      Version *list = retired.load(std::memory_order_relaxed);
+      while (list) {
+        Version *next = list->next_retired;
+        delete list;
+        list = next;
       }
-      return result;
     }
 
-    // Upper bound implementation
-    NodePtr upper_bound(NodePtr x, const Key &key) const {
-      NodePtr result = nullptr;
-      while (x) {
-        if (comp(key, x->key)) {
-          result = x;
-          x = x->left;
-        } else {
-          x = x->right;
-        }
-      }
-      return result;
+    // Root and size of the current version, consistent with each other
+    Version snapshot() const {
+      EpochPin pin;
+      Version *cur = current.load(std::memory_order_acquire);
+      return Version{cur->root, cur->count};
     }
 
-    // Public insert interface
+    // Insert key into the current version, returns the committed root
+    // and whether key was new
     std::pair<NodePtr, bool> insert(const Key &key) {
-      bool inserted = false;
-      NodePtr new_root = insert(root, key, inserted);
-      if (inserted) {
-        return {new_root, true};
-      } else {
-        return {root, false};
-      }
+      return commit([&](Node *root, size_t count) {
+        // The extra reference on root makes every node on the path shared,
+        // so the published version is copied, never edited
+        bool inserted = false;
+        NodePtr new_root = insertNode(share(root), key, comp, inserted);
+        return std::tuple<NodePtr, size_t, bool>(
+            paint(std::move(new_root), BLACK), count + 1, inserted);
+      });
     }
 
-    // Public erase interface
+    // Erase key from the current version, returns the committed root and
+    // whether key was present
     std::pair<NodePtr, bool> erase(const Key &key) {
-      bool erased = false;
-      NodePtr new_root = erase(root, key, erased);
-      if (erased) {
-        return {new_root, true};
-      } else {
-        return {root, false};
-      }
+      return commit([&](Node *root, size_t count) {
+        if (!findNode(root, key, comp))
+          return std::tuple<NodePtr, size_t, bool>(nullptr, count, false);
+        return std::tuple<NodePtr, size_t, bool>(
+            paint(eraseNode(share(root), key, comp), BLACK), count - 1, true);
+      });
     }
 
-    // Update the tree with new root and count
-    void update(NodePtr new_root, size_t delta) {
-      root = new_root;
-      node_count += delta;
+    void clear() {
+      commit([](const Node *root, size_t) {
+        return std::tuple<NodePtr, size_t, bool>(nullptr, 0, root != nullptr);
+      });
     }
 
     // Getters
-    NodePtr getRoot() const { return root; }
-    size_t size() const { return node_count; }
+    NodePtr getRoot() const { return snapshot().root; }
+    size_t size() const { return snapshot().count; }
   };
 
   RBTree tree;
 
 public:
-  // Simplified iterator implementation
+  // Bidirectional iterator over one version. It holds a reference to that
+  // version's root and the path from the root to the current node, so it
+  // needs no parent links and stays valid while the set moves on.
   class const_iterator {
+    friend class ESet;
+
   private:
-    NodePtr node;
-    const RBTree *tree;
+    // Red-black height bound for fewer than 2^32 keys
+    static constexpr int MAX_HEIGHT = 64;
+
+    NodePtr root; // version being iterated, kept alive by the iterator
+    const Node *path[MAX_HEIGHT];
+    int depth; // path[0 .. depth) leads to the current node, 0 is end()
+
+    explicit const_iterator(NodePtr r) : root(std::move(r)), depth(0) {}
+
+    void pushLeftmost(const Node *x) {
+      for (; x; x = x->left)
+        path[depth++] = x;
+    }
+
+    void pushRightmost(const Node *x) {
+      for (; x; x = x->right)
+        path[depth++] = x;
+    }
+
+    const Node *node() const { return depth ? path[depth - 1] : nullptr; }
 
   public:
-    const_iterator(NodePtr n = nullptr, const RBTree *t = nullptr)
-        : node(n), tree(t) {}
+    const_iterator() : depth(0) {}
+
+    const_iterator(const const_iterator &other)
+        : root(other.root), depth(other.depth) {
+      std::copy(other.path, other.path + depth, path);
+    }
+
+    const_iterator &operator=(const const_iterator &other) {
+      root = other.root;
+      depth = other.depth;
+      std::copy(other.path, other.path + depth, path);
+      return *this;
+    }
 
     const Key &operator*() const {
-      if (!node) {
+      if (!depth) {
         throw std::out_of_range("dereferencing end iterator");
       }
-      return node->key;
+      return path[depth - 1]->key;
     }
+
     // 前置递减
     const_iterator &operator--() {
-      if (!node) {
-        if (!tree || !tree->getRoot())
-          return *this;
-        node = tree->maximum(tree->getRoot());
-      } else {
-        node = tree->predecessor(node);
+      if (!depth) {
+        pushRightmost(root.get());
+        return *this;
       }
+      const Node *x = path[depth - 1];
+      if (x->left) {
+        pushRightmost(x->left);
+        return *this;
+      }
+      // Climb out of right subtrees; at the first element, stay put
+      int d = depth;
+      do {
+        x = path[--d];
+      } while (d && path[d - 1]->left == x);
+      if (d)
+        depth = d;
       return *this;
     }
 
@@ -282,9 +624,17 @@ public:
 
     // 前置递增
     const_iterator &operator++() {
-      if (!node)
+      if (!depth)
+        return *this;
+      const Node *x = path[depth - 1];
+      if (x->right) {
+        pushLeftmost(x->right);
         return *this;
-      node = tree->successor(node);
+      }
+      // Climb out of left subtrees
+      do {
+        x = path[--depth];
+      } while (depth && path[depth - 1]->right == x);
       return *this;
     }
 
@@ -297,58 +647,140 @@ public:
 
     // 比较操作
     bool operator==(const const_iterator &rhs) const {
-      return node == rhs.node;
+      return node() == rhs.node();
     }
 
     bool operator!=(const const_iterator &rhs) const {
-      return node != rhs.node;
+      return node() != rhs.node();
     }
   };
 
   using iterator = const_iterator;
 
+private:
+  // Iterator at the first key of the version rooted at root for which
+  // go_left holds, end() if there is none
+  template <class GoLeft>
+  iterator descend(NodePtr root, GoLeft go_left) const {
+    iterator it(std::move(root));
+    int found = 0;
+    for (const Node *x = it.root.get(); x;) {
+      it.path[it.depth++] = x;
+      if (go_left(x->key)) {
+        found = it.depth;
+        x = x->left;
+      } else {
+        x = x->right;
+      }
+    }
+    it.depth = found;
+    return it;
+  }
+
+  iterator lowerBound(NodePtr root, const Key &key) const {
+    return descend(std::move(root),
+                   [&](const Key &x) { return !tree.comp(x, key); });
+  }
+
+  iterator findIn(NodePtr root, const Key &key) const {
+    iterator it = lowerBound(std::move(root), key);
+    if (it.depth && tree.comp(key, *it))
+      it.depth = 0;
+    return it;
+  }
+
+  ESet(NodePtr root, size_t count, const Compare &comp)
+      : tree(std::move(root), count, comp) {}
+
+public:
+  // Batch-mutable handle on one version, like Clojure's transients. It
+  // edits nodes only it refers to in place and copies the ones it still
+  // shares with published versions, so a bulk load allocates about one
+  // node per key. Must not be used by several threads at once.
+  class Transient {
+    friend class ESet;
+
+  private:
+    NodePtr root;
+    size_t count;
+    Compare comp;
+
+    Transient(NodePtr r, size_t cnt, const Compare &c)
+        : root(std::move(r)), count(cnt), comp(c) {}
+
+  public:
+    // Returns whether key was new
+    bool emplace(const Key &key) {
+      bool inserted = false;
+      root = paint(insertNode(std::move(root), key, comp, inserted), BLACK);
+      count += inserted;
+      return inserted;
+    }
+
+    size_t erase(const Key &key) {
+      if (!findNode(root.get(), key, comp))
+        return 0;
+      root = paint(eraseNode(std::move(root), key, comp), BLACK);
+      --count;
+      return 1;
+    }
+
+    bool contains(const Key &key) const {
+      return findNode(root.get(), key, comp) != nullptr;
+    }
+
+    size_t size() const { return count; }
+
+    // Publish the current contents in O(1). The result shares every node,
+    // so further edits through this handle copy the nodes they touch.
+    ESet persistent() const { return ESet(root, count, comp); }
+  };
+
   ESet() = default;
   ~ESet() = default;
 
-  // Copy and move operations are O(1) due to shared_ptr
+  // Copies are O(1) and share the current version; moves take it and
+  // leave other empty
   ESet(const ESet &other) = default;
   ESet &operator=(const ESet &other) = default;
-  ESet(ESet &&other) noexcept = default;
-  ESet &operator=(ESet &&other) noexcept = default;
+  ESet(ESet &&other) = default;
+  ESet &operator=(ESet &&other) = default;
+
+  // Point-in-time copy of the current version. With SharedRefCount, safe
+  // to call while other threads modify this set; the copy never changes
+  // afterwards, so iterate over a snapshot rather than over a set that is
+  // being written to.
+  ESet snapshot() const { return *this; }
+
+  // Transient handle starting from the current version, in O(1)
+  Transient transient() const {
+    auto version = tree.snapshot();
+    return Transient(std::move(version.root), version.count, tree.comp);
+  }
 
-  // Insert element
+  // Insert element; with SharedRefCount, safe to call from several threads
+  // at once
   std::pair<iterator, bool> emplace(const Key &key) {
-    auto [new_root, inserted] = tree.insert(key);
-    if (inserted) {
-      tree.update(new_root, 1);
-      return {iterator(new_root, &tree), true};
-    }
-    return {iterator(tree.find(tree.getRoot(), key), &tree), false};
+    auto [root, inserted] = tree.insert(key);
+    return {findIn(std::move(root), key), inserted};
   }
 
-  // Erase element
-  size_t erase(const Key &key) {
-    auto [new_root, erased] = tree.erase(key);
-    if (erased) {
-      tree.update(new_root, -1);
-      return 1;
-    }
-    return 0;
-  }
+  // Erase element; with SharedRefCount, safe to call from several threads
+  // at once
+  size_t erase(const Key &key) { return tree.erase(key).second ? 1 : 0; }
 
   // Find element
-  iterator find(const Key &key) const {
-    return iterator(tree.find(tree.getRoot(), key), &tree);
-  }
+  iterator find(const Key &key) const { return findIn(tree.getRoot(), key); }
 
   // Lower bound
   iterator lower_bound(const Key &key) const {
-    return iterator(tree.lower_bound(tree.getRoot(), key), &tree);
+    return lowerBound(tree.getRoot(), key);
   }
 
   // Upper bound
   iterator upper_bound(const Key &key) const {
-    return iterator(tree.upper_bound(tree.getRoot(), key), &tree);
+    return descend(tree.getRoot(),
+                   [&](const Key &x) { return tree.comp(key, x); });
   }
 
   // Range count
@@ -357,10 +789,9 @@ public:
       return 0;
 
     size_t cnt = 0;
-    auto it = lower_bound(l);
-    auto end = upper_bound(r);
-
-    while (it != end) {
+    NodePtr root = tree.getRoot();
+    auto it = lowerBound(root, l);
+    while (it.depth && !tree.comp(r, *it)) {
       ++cnt;
       ++it;
     }
@@ -369,17 +800,19 @@ public:
 
   // Begin iterator
   iterator begin() const {
-    return iterator(tree.minimum(tree.getRoot()), &tree);
+    iterator it(tree.getRoot());
+    it.pushLeftmost(it.root.get());
+    return it;
   }
 
   // End iterator
-  iterator end() const { return iterator(nullptr, &tree); }
+  iterator end() const { return iterator(tree.getRoot()); }
 
   // Size
   size_t size() const { return tree.size(); }
 
   // Clear
-  void clear() { tree = RBTree(); }
+  void clear() { tree.clear(); }
 };
 
-#endif
\ No newline at end of file
+#endif
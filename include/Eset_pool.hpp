@@ -0,0 +1,352 @@
+#ifndef SJTU_ESET_POOL_HPP
+#define SJTU_ESET_POOL_HPP
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+//  ESetPool: default node allocator for ESet.
+//  Nodes are carved out of slabs and erased nodes go onto a free list, so
+//  steady insert/erase churn never reaches malloc. The first slab holds only
+//  a few nodes and each new one doubles up to 64 KB, so a small set stays
+//  small. release() drops every slab at once, which lets ESet::clear() skip
+//  the per-node walk. With HugePages = true slabs are 2 MB and backed by huge
+//  pages where the OS allows it (Linux), falling back to ordinary pages
+//  otherwise.
+//  Each pool owns its arena: copies start empty, moves steal the slabs.
+
+template <class T, bool HugePages = false> class ESetPool {
+  template <class, bool> friend class ESetPool;
+
+private:
+  struct FreeSlot {
+    FreeSlot *next;
+  };
+
+  // Header placed at the start of every slab
+  struct Slab {
+    Slab *next;
+    size_t bytes;
+    bool mapped;
+  };
+
+  static constexpr size_t SLAB_SIZE = HugePages ? (2u << 20) : (64u << 10);
+  static constexpr size_t SLOT_ALIGN =
+      alignof(T) > alignof(FreeSlot) ? alignof(T) : alignof(FreeSlot);
+  static constexpr size_t SLOT_SIZE =
+      ((sizeof(T) > sizeof(FreeSlot) ? sizeof(T) : sizeof(FreeSlot)) +
+       SLOT_ALIGN - 1) /
+      SLOT_ALIGN * SLOT_ALIGN;
+  static constexpr size_t HEADER_SIZE =
+      (sizeof(Slab) + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+  static_assert(HEADER_SIZE + SLOT_SIZE <= SLAB_SIZE, "node too large");
+  static constexpr size_t FIRST_SLAB_SIZE =
+      HugePages ? SLAB_SIZE : HEADER_SIZE + 4 * SLOT_SIZE;
+
+  Slab *slabs;
+  Slab *slab_tail; // last slab, so absorb() is O(1)
+  FreeSlot *free_list;
+  FreeSlot *free_tail; // last free slot, valid while free_list is non-null
+  char *cur;
+  char *end;
+  size_t next_slab; // size of the next slab grow() takes
+
+  // Get a fresh slab of at least min_bytes from the OS and make it the bump
+  // region
+  void grow(size_t min_bytes = 0) {
+    size_t bytes = min_bytes > next_slab ? min_bytes : next_slab;
+    if constexpr (HugePages)
+      bytes = (bytes + SLAB_SIZE - 1) / SLAB_SIZE * SLAB_SIZE;
+    if (next_slab < SLAB_SIZE)
+      next_slab = next_slab * 2 < SLAB_SIZE ? next_slab * 2 : SLAB_SIZE;
+    Slab *slab = nullptr;
+#if defined(__linux__)
+    if constexpr (HugePages) {
+      void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (p == MAP_FAILED) {
+        // No reserved huge pages, ask for transparent huge pages instead
+        p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+          throw std::bad_alloc();
+        madvise(p, bytes, MADV_HUGEPAGE);
+      }
+      slab = static_cast<Slab *>(p);
+      slab->mapped = true;
+    }
+#endif
+    if (!slab) {
+      slab = static_cast<Slab *>(::operator new(bytes));
+      slab->mapped = false;
+    }
+    slab->bytes = bytes;
+    slab->next = slabs;
+    if (!slabs)
+      slab_tail = slab;
+    slabs = slab;
+    cur = reinterpret_cast<char *>(slab) + HEADER_SIZE;
+    end = reinterpret_cast<char *>(slab) + bytes;
+  }
+
+  static void freeSlab(Slab *slab) noexcept {
+#if defined(__linux__)
+    if (slab->mapped) {
+      munmap(slab, slab->bytes);
+      return;
+    }
+#endif
+    ::operator delete(slab);
+  }
+
+public:
+  using value_type = T;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  template <class U> struct rebind {
+    using other = ESetPool<U, HugePages>;
+  };
+
+  ESetPool() noexcept
+      : slabs(nullptr), slab_tail(nullptr), free_list(nullptr),
+        free_tail(nullptr), cur(nullptr), end(nullptr), next_slab(FIRST_SLAB_SIZE) {}
+
+  // A copied pool never shares the source's arena
+  ESetPool(const ESetPool &) noexcept : ESetPool() {}
+  template <class U>
+  ESetPool(const ESetPool<U, HugePages> &) noexcept : ESetPool() {}
+
+  ESetPool(ESetPool &&other) noexcept
+      : slabs(other.slabs), slab_tail(other.slab_tail),
+        free_list(other.free_list), free_tail(other.free_tail),
+        cur(other.cur), end(other.end), next_slab(other.next_slab) {
+    other.slabs = nullptr;
+    other.free_list = nullptr;
+    other.cur = other.end = nullptr;
+    other.next_slab = FIRST_SLAB_SIZE;
+  }
+
+  ESetPool &operator=(const ESetPool &) noexcept { return *this; }
+
+  ESetPool &operator=(ESetPool &&other) noexcept {
+    if (this != &other) {
+      release();
+      std::swap(slabs, other.slabs);
+      std::swap(slab_tail, other.slab_tail);
+      std::swap(free_list, other.free_list);
+      std::swap(free_tail, other.free_tail);
+      std::swap(cur, other.cur);
+      std::swap(end, other.end);
+      std::swap(next_slab, other.next_slab);
+    }
+    return *this;
+  }
+
+  ~ESetPool() { release(); }
+
+  ESetPool select_on_container_copy_construction() const { return ESetPool(); }
+
+  // Single nodes come from the free list or the current slab; anything
+  // larger is forwarded to the global allocator
+  __attribute__((always_inline)) inline T *allocate(size_t n) {
+    if (n != 1)
+      return static_cast<T *>(::operator new(n * sizeof(T)));
+    if (free_list) {
+      FreeSlot *slot = free_list;
+      free_list = slot->next;
+      return reinterpret_cast<T *>(slot);
+    }
+    if (static_cast<size_t>(end - cur) < SLOT_SIZE)
+      grow();
+    T *p = reinterpret_cast<T *>(cur);
+    cur += SLOT_SIZE;
+    return p;
+  }
+
+  __attribute__((always_inline)) inline void deallocate(T *p,
+                                                        size_t n) noexcept {
+    if (n != 1) {
+      ::operator delete(p);
+      return;
+    }
+    FreeSlot *slot = reinterpret_cast<FreeSlot *>(p);
+    slot->next = free_list;
+    if (!free_list)
+      free_tail = slot;
+    free_list = slot;
+  }
+
+  // Make the next n single-node allocations one contiguous, ascending run
+  // (as long as the free list is empty, e.g. right after release())
+  void reserve(size_t n) {
+    if (static_cast<size_t>(end - cur) / SLOT_SIZE < n)
+      grow(HEADER_SIZE + n * SLOT_SIZE);
+  }
+
+  // Take over other's slabs and free slots, so nodes allocated by other can
+  // be freed through this pool; the rest of other's bump region is dropped.
+  // Both lists are spliced at other's tails, so this is O(1)
+  void absorb(ESetPool &other) noexcept {
+    if (this == &other)
+      return;
+    if (other.slabs) {
+      other.slab_tail->next = slabs;
+      if (!slabs)
+        slab_tail = other.slab_tail;
+      slabs = other.slabs;
+    }
+    if (other.free_list) {
+      other.free_tail->next = free_list;
+      if (!free_list)
+        free_tail = other.free_tail;
+      free_list = other.free_list;
+    }
+    other.slabs = nullptr;
+    other.free_list = nullptr;
+    other.cur = other.end = nullptr;
+  }
+
+  // Return every slab to the OS; all nodes handed out become invalid
+  void release() noexcept {
+    while (slabs) {
+      Slab *next = slabs->next;
+      freeSlab(slabs);
+      slabs = next;
+    }
+    slab_tail = nullptr;
+    free_list = nullptr;
+    cur = end = nullptr;
+  }
+
+  bool operator==(const ESetPool &rhs) const noexcept { return this == &rhs; }
+  bool operator!=(const ESetPool &rhs) const noexcept { return this != &rhs; }
+};
+
+//  ESetSharedPool: process-wide node pool for structures whose nodes are
+//  shared between containers (persistent versions), so a node may be freed
+//  by another container, or another thread, than the one that made it.
+//  Each thread keeps a cache of free slots and trades them with a global
+//  free list in batches; slabs are kept until the process exits.
+
+template <class T> class ESetSharedPool {
+private:
+  struct FreeSlot {
+    FreeSlot *next;
+  };
+
+  // Trivially destructible, so it stays usable after the thread's Flusher
+  // has run (nodes may still be freed by later thread_local destructors)
+  struct Cache {
+    FreeSlot *head;
+    size_t count;
+    bool closed;
+  };
+
+  struct Flusher {
+    Cache &cache;
+    ~Flusher() {
+      instance().giveBack(cache.head, cache.count);
+      cache.head = nullptr;
+      cache.count = 0;
+      cache.closed = true;
+    }
+  };
+
+  static constexpr size_t BATCH = 256;
+
+  std::mutex lock;
+  ESetPool<T> arena; // guarded by lock, never released
+  FreeSlot *free_list = nullptr;
+
+  static ESetSharedPool &instance() {
+    // Never destroyed: nodes may be freed from static destructors
+    static ESetSharedPool *pool = new ESetSharedPool;
+    return *pool;
+  }
+
+  static Cache &cache() {
+    thread_local Cache c{nullptr, 0, false};
+    thread_local Flusher flusher{c};
+    (void)flusher;
+    return c;
+  }
+
+  FreeSlot *take() {
+    if (free_list) {
+      FreeSlot *slot = free_list;
+      free_list = slot->next;
+      return slot;
+    }
+    return reinterpret_cast<FreeSlot *>(arena.allocate(1));
+  }
+
+  void refill(Cache &c) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i = 0; i < BATCH; ++i) {
+      FreeSlot *slot = take();
+      slot->next = c.head;
+      c.head = slot;
+    }
+    c.count += BATCH;
+  }
+
+  // Splice the n slots starting at head onto the global free list
+  void giveBack(FreeSlot *head, size_t n) {
+    if (!n)
+      return;
+    FreeSlot *tail = head;
+    for (size_t i = 1; i < n; ++i)
+      tail = tail->next;
+    std::lock_guard<std::mutex> guard(lock);
+    tail->next = free_list;
+    free_list = head;
+  }
+
+public:
+  __attribute__((always_inline)) inline static T *allocate() {
+    Cache &c = cache();
+    if (!c.head) {
+      if (c.closed) {
+        std::lock_guard<std::mutex> guard(instance().lock);
+        return reinterpret_cast<T *>(instance().take());
+      }
+      instance().refill(c);
+    }
+    FreeSlot *slot = c.head;
+    c.head = slot->next;
+    --c.count;
+    return reinterpret_cast<T *>(slot);
+  }
+
+  __attribute__((always_inline)) inline static void deallocate(T *p) noexcept {
+    Cache &c = cache();
+    FreeSlot *slot = reinterpret_cast<FreeSlot *>(p);
+    if (c.closed) {
+      slot->next = nullptr;
+      instance().giveBack(slot, 1);
+      return;
+    }
+    slot->next = c.head;
+    c.head = slot;
+    // Keep at most two batches: hand the newest one back
+    if (++c.count == 2 * BATCH) {
+      FreeSlot *rest = c.head;
+      for (size_t i = 1; i < BATCH; ++i)
+        rest = rest->next;
+      FreeSlot *batch = c.head;
+      c.head = rest->next;
+      rest->next = nullptr;
+      c.count -= BATCH;
+      instance().giveBack(batch, BATCH);
+    }
+  }
+};
+
+#endif